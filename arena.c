@@ -0,0 +1,217 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* Size of the first chunk, each new chunk is twice as big as the
+   previous one, up to MAX_CHUNK (unless a single allocation needs
+   more). Capping the growth keeps the part of the last chunk not used
+   yet, which is charged to the budget all the same, small. */
+#define MIN_CHUNK (1 << 20)
+#define MAX_CHUNK (16 << 20)
+
+#define ALIGN(n) (((n)+15) & ~(size_t) 15)
+
+struct arena_chunk_t {
+  arena_chunk_t *prev;
+  size_t size;
+  size_t used;
+  /* Keep data aligned to 16 bytes. */
+  size_t padding;
+  char data[];
+};
+
+/* Charge between n and size bytes to the budget, as many as are left.
+   Returns the number charged, or 0 if not even n are left. */
+static size_t charge(arena_budget_t *budget, size_t n, size_t size)
+{
+  size_t used = __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+  size_t left, charged;
+
+  do {
+    left = (used < budget->limit) ? budget->limit - used : 0;
+    if (left < n)
+      return 0;
+    charged = (size < left) ? size : left;
+  } while (!__atomic_compare_exchange_n(&budget->used, &used, used + charged,
+					0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  return charged;
+}
+
+static void uncharge(arena_budget_t *budget, size_t n)
+{
+  if (budget)
+    __atomic_fetch_sub(&budget->used, n, __ATOMIC_RELAXED);
+}
+
+static arena_chunk_t *new_chunk(arena_chunk_t *prev, size_t size)
+{
+  arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+
+  if (!chunk) {
+    fprintf(stderr, "ERROR: out of memory allocating %zu bytes.\n", size);
+    abort();
+  }
+
+  chunk->prev = prev;
+  chunk->size = size;
+  chunk->used = 0;
+
+  return chunk;
+}
+
+void arena_budget_init(arena_budget_t *budget, size_t limit)
+{
+  budget->limit = limit;
+  budget->used = 0;
+}
+
+void arena_init(arena_t *arena, arena_budget_t *budget)
+{
+  arena->chunk = NULL;
+  arena->capacity = 0;
+  arena->peak = 0;
+  arena->budget = budget;
+}
+
+void *arena_alloc(arena_t *arena, size_t n)
+{
+  arena_chunk_t *chunk = arena->chunk;
+  void *ptr;
+
+  n = ALIGN(n);
+
+  if (!chunk || chunk->used + n > chunk->size) {
+    size_t size = chunk ? 2*chunk->size : MIN_CHUNK;
+
+    if (size > MAX_CHUNK)
+      size = MAX_CHUNK;
+    if (size < n)
+      size = n;
+
+    /* Close to the limit, take whatever is left. */
+    if (arena->budget) {
+      size = charge(arena->budget, n, size);
+      if (!size) {
+	fprintf(stderr, "ERROR: the memory budget of %zu MB is not enough.\n",
+		arena->budget->limit >> 20);
+	abort();
+      }
+    }
+
+    chunk = arena->chunk = new_chunk(chunk, size);
+    arena->capacity += size;
+    if (arena->capacity > arena->peak)
+      arena->peak = arena->capacity;
+  }
+
+  ptr = &chunk->data[chunk->used];
+  chunk->used += n;
+
+  return ptr;
+}
+
+void *arena_grow(arena_t *arena, void *ptr, size_t n, size_t size)
+{
+  arena_chunk_t *chunk = arena->chunk;
+  void *result;
+
+  if (size <= n)
+    return ptr;
+
+  /* The last allocation in the chunk can grow in place. */
+  if (ptr && (char *) ptr + ALIGN(n) == &chunk->data[chunk->used]
+      && (size_t) ((char *) ptr - chunk->data) + ALIGN(size) <= chunk->size) {
+    chunk->used += ALIGN(size) - ALIGN(n);
+    return ptr;
+  }
+
+  result = arena_alloc(arena, size);
+  if (n > 0)
+    memcpy(result, ptr, n);
+
+  return result;
+}
+
+arena_mark_t arena_mark(const arena_t *arena)
+{
+  arena_mark_t mark = {
+    .chunk = arena->chunk,
+    .used = arena->chunk ? arena->chunk->used : 0
+  };
+
+  return mark;
+}
+
+void arena_release(arena_t *arena, arena_mark_t mark)
+{
+  /* Chunks allocated after the mark are not needed any more. */
+  while (arena->chunk != mark.chunk) {
+    arena_chunk_t *prev = arena->chunk->prev;
+
+    arena->capacity -= arena->chunk->size;
+    uncharge(arena->budget, arena->chunk->size);
+    free(arena->chunk);
+    arena->chunk = prev;
+  }
+
+  if (arena->chunk)
+    arena->chunk->used = mark.used;
+}
+
+void arena_reset(arena_t *arena)
+{
+  size_t peak = arena->peak;
+
+  if (!arena->chunk)
+    return;
+
+  /* If the last round needed several chunks, replace them by a single
+     one big enough to hold all of them, so the next round of
+     allocations (which is usually of a similar size) does not need to
+     call malloc. */
+  if (arena->chunk->prev || arena->chunk->size < peak) {
+    arena_free(arena);
+    /* Other arenas may have taken the budget in the meantime. */
+    if (arena->budget && !charge(arena->budget, peak, peak))
+      return;
+    arena->chunk = new_chunk(NULL, peak);
+    arena->capacity = peak;
+  }
+
+  arena->chunk->used = 0;
+  arena->peak = arena->capacity;
+}
+
+void arena_free(arena_t *arena)
+{
+  uncharge(arena->budget, arena->capacity);
+
+  while (arena->chunk) {
+    arena_chunk_t *prev = arena->chunk->prev;
+
+    free(arena->chunk);
+    arena->chunk = prev;
+  }
+
+  arena->capacity = 0;
+  arena->peak = 0;
+}
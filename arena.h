@@ -0,0 +1,62 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/* A region of memory from which objects are allocated by bumping a
+   pointer, and which is released all at once. Allocations are
+   aligned to 16 bytes. */
+typedef struct arena_chunk_t arena_chunk_t;
+
+/* A limit on the memory held by a group of arenas, which may be used
+   from different threads: the chunks of all of them are charged to
+   it. Going over it aborts the program. */
+typedef struct {
+  size_t limit; /* In bytes */
+  size_t used; /* Only accessed atomically */
+} arena_budget_t;
+
+typedef struct {
+  arena_chunk_t *chunk; /* The chunk being filled, NULL if none */
+  size_t capacity; /* Total size of all the chunks */
+  size_t peak; /* Largest capacity since the last reset */
+
+  /* The budget the chunks are charged to, or NULL for no limit. */
+  arena_budget_t *budget;
+} arena_t;
+
+/* A position in the arena, see arena_release. */
+typedef struct {
+  arena_chunk_t *chunk;
+  size_t used;
+} arena_mark_t;
+
+/* Initialize a budget of limit bytes, with nothing charged to it. */
+void arena_budget_init(arena_budget_t *budget, size_t limit);
+
+/* Initialize an empty arena, charging its memory to the given budget
+   (NULL for no limit). */
+void arena_init(arena_t *arena, arena_budget_t *budget);
+
+/* Allocate n bytes from the arena. Never returns NULL. */
+void *arena_alloc(arena_t *arena, size_t n);
+
+/* Make the array at ptr, holding n bytes and allocated from the
+   arena, hold at least size bytes, copying it if needed. The old
+   space is only reclaimed when the arena is reset. */
+void *arena_grow(arena_t *arena, void *ptr, size_t n, size_t size);
+
+/* The current position in the arena. */
+arena_mark_t arena_mark(const arena_t *arena);
+
+/* Release everything allocated since the given mark was taken. */
+void arena_release(arena_t *arena, arena_mark_t mark);
+
+/* Release everything allocated from the arena, but keep the memory
+   around for the next round of allocations. */
+void arena_reset(arena_t *arena);
+
+/* Return the memory held by the arena to the system. */
+void arena_free(arena_t *arena);
+
+#endif
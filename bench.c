@@ -0,0 +1,452 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Benchmarks of libcech on the examples in cohomology.py. Each case is
+   run a few times with each way of finding the regions, and the
+   fastest time of each phase is written out as tab separated values,
+   which can be compared with the output of another build (see usage).
+   Only the sparse elimination backend is used, so homchain is not
+   needed. The results are checked against the known ones, and the
+   sweeps against a separate computation at each point of their grids;
+   the exit status is nonzero if any of them is wrong. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cech.h"
+#include "timing.h"
+
+#define MAX_RAYS 16
+#define MAX_CONES 64
+#define MAX_CONE_SIZE 8
+#define MAX_DIM 8
+#define MAX_DIRS 2
+
+typedef struct {
+  const char *name;
+  int dim;
+  int nrays;
+  int rays[MAX_RAYS*MAX_CONE_SIZE];
+  int ncones;
+  int cone_sizes[MAX_CONES];
+  int cone_rays[MAX_CONES*MAX_CONE_SIZE];
+} bench_fan_t;
+
+typedef struct {
+  const char *name;
+  const bench_fan_t *fan;
+  int divisor[MAX_RAYS];
+  int k;
+  int box; /* Whether the box is small enough to be traversed too */
+  const char *expected; /* The result, as written out */
+  /* Compact regions found, the same for every traversal: unbounded
+     regions inside the box must not be counted. */
+  long long regions;
+} bench_case_t;
+
+static const bench_fan_t dP1 = {
+  "dP_1", 2, 4,
+  {1,0, 0,1, -1,-1, 0,-1},
+  4, {2, 2, 2, 2},
+  {0,1, 1,2, 2,3, 3,0}
+};
+
+static const bench_fan_t P2 = {
+  "P^2", 2, 3,
+  {1,0, 0,1, -1,-1},
+  3, {2, 2, 2},
+  {0,1, 1,2, 2,0}
+};
+
+/* From 1002.1894, around eq. 48. */
+static const bench_fan_t fivefold = {
+  "1002.1894", 5, 7,
+  {0,0,0,1,0, 0,0,0,0,1, 0,0,0,-2,-3, -1,-1,-1,-8,-12,
+   1,0,0,0,0, 0,1,0,0,0, 0,0,1,0,0},
+  12, {5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5},
+  {0,1,3,4,5, 0,1,3,4,6, 0,1,3,5,6, 0,1,4,5,6,
+   0,2,3,4,5, 0,2,3,4,6, 0,2,3,5,6, 0,2,4,5,6,
+   1,2,3,4,5, 1,2,3,4,6, 1,2,3,5,6, 1,2,4,5,6}
+};
+
+/* The elliptic fibration at the end of cohomology.py. Its cones are
+   filled in by sixfold_cones. */
+static bench_fan_t sixfold = {
+  "fibration", 6, 11,
+  {1,0,0,0,0,0, 0,1,0,0,0,0, 0,0,1,0,0,0, 0,0,0,1,0,0, 0,0,0,0,1,0,
+   -3,-2,0,0,0,0, 6,4,1,1,1,0, -6,-4,0,-1,0,0, 0,0,2,1,1,3,
+   -3,-2,-2,-1,-1,-2, 9,6,2,1,1,0},
+  0, {0}, {0}
+};
+
+static void sixfold_cones(bench_fan_t *fan)
+{
+  static const int base[15][4] = {
+    {1,2,3,4}, {1,2,3,8}, {1,2,4,7}, {1,2,5,7}, {1,2,5,8},
+    {1,3,4,6}, {1,3,6,8}, {1,4,6,7}, {1,5,6,7}, {1,5,6,8},
+    {2,3,4,6}, {2,3,6,8}, {2,4,6,7}, {2,5,6,7}, {2,5,6,8}
+  };
+  static const int fiber[3][2] = { {9,10}, {9,11}, {10,11} };
+  int i, j, l, *cone;
+
+  fan->ncones = 0;
+  for (i=0; i<15; i++) {
+    for (j=0; j<3; j++) {
+      cone = &fan->cone_rays[6*fan->ncones];
+      for (l=0; l<4; l++)
+	cone[l] = base[i][l]-1;
+      cone[4] = fiber[j][0]-1;
+      cone[5] = fiber[j][1]-1;
+      fan->cone_sizes[fan->ncones++] = 6;
+    }
+  }
+}
+
+static const bench_case_t cases[] = {
+  { "dP_1", &dP1, {5,0,0,-2}, CECH_ALL_DEGREES, 1, "0,7,0", 2 },
+  { "P^2", &P2, {7,1,-1}, CECH_ALL_DEGREES, 1, "36,0,0", 1 },
+  { "1002.1894", &fivefold, {-1,-1,-1,-1,-1,-1,-5}, CECH_ALL_DEGREES, 1,
+    "0,0,0,0,0,35", 1 },
+  /* NstarBase+NstarFiber, NstarDiv+NstarFiber and NstarBase+NstarDiv */
+  { "fibration_D", &sixfold, {-1,-1,-1,-1,0,-1,0,-1,0,-2,0}, 3, 1, "0", 1 },
+  { "fibration_D1", &sixfold, {0,0,0,0,-1,0,0,0,0,-2,0}, 3, 1, "0", 0 },
+  { "fibration_D2", &sixfold, {-1,-1,-1,-1,-1,-1,0,-1,0,0,0}, 3, 1, "0", 1 },
+  /* A larger divisor, with many more regions, in a box too large to
+     traverse. */
+  { "fibration_8", &sixfold, {0,0,0,0,0,0,0,0,8,8,0}, 1, 0, "11270", 9 },
+  { "fibration_8", &sixfold, {0,0,0,0,0,0,0,0,8,8,0}, 2, 0, "0", 9 }
+};
+#define NCASES ((int) (sizeof(cases)/sizeof(cases[0])))
+
+/* Sweeps in explicit boxes, tight enough that compact regions touch
+   their boundary at some points of the grid and not at others. */
+typedef struct {
+  const char *name;
+  const bench_fan_t *fan;
+  int divisor[MAX_RAYS];
+  int box[2*MAX_DIM];
+  int ndirs;
+  cech_direction_t dirs[MAX_DIRS];
+} sweep_case_t;
+
+static const sweep_case_t sweeps[] = {
+  { "dP_1", &dP1, {5,0,0,-2}, {-6,3, -3,6}, 2, {{0,-4,2}, {3,-2,3}} },
+  { "1002.1894", &fivefold, {-1,-1,-1,-1,-1,-1,-5},
+    {-28,2, -28,2, -24,6, -3,2, -2,2}, 1, {{6,-3,3}} }
+};
+#define NSWEEPS ((int) (sizeof(sweeps)/sizeof(sweeps[0])))
+
+/* The ways of finding the regions, and their names in the output. */
+#define NTRAVERSALS 3
+static const traversal_mode_t traversals[NTRAVERSALS] = {
+  TRAVERSE_CHAMBERS, TRAVERSE_ROWS, TRAVERSE_POINTS
+};
+static const char *traversal_names[NTRAVERSALS] = {
+  "chamber", "row", "point"
+};
+
+/* The phases timed, in the order of the columns. */
+#define NPHASES 9
+static const char *phase_names[NPHASES] = {
+  "setup", "box", "traversal", "orbits", "cohomology", "layers", "build",
+  "rank", "total"
+};
+
+typedef struct {
+  char name[64];
+  char traversal[16];
+  int k;
+  double times[NPHASES];
+} bench_result_t;
+
+/* Run the case once, storing the time of each phase, the result and
+   the number of compact regions found. */
+static void run_case(const bench_case_t *bc, const cech_options_t *opts,
+		     double *times, char *result, long long *regions)
+{
+  const bench_fan_t *fan = bc->fan;
+  cech_profile_t profile;
+  cech_fan_t *cf;
+  int h[MAX_CONE_SIZE+1];
+  double start, setup;
+  int i, n;
+
+  cech_profile_init(&profile);
+
+  start = wall_time();
+  cf = cech_fan_new(fan->dim, fan->rays, fan->nrays, fan->cone_sizes,
+		    fan->cone_rays, fan->ncones, opts);
+  if (!cf) {
+    fprintf(stderr, "ERROR: could not set up the fan of %s\n", bc->name);
+    abort();
+  }
+  setup = wall_time();
+  cech_compute(cf, bc->divisor, NULL, bc->k, h, &profile);
+  times[NPHASES-1] = wall_time() - start;
+  cech_fan_free(cf);
+
+  times[0] = setup - start;
+  times[1] = profile.box;
+  times[2] = profile.traversal;
+  times[3] = profile.orbits;
+  times[4] = profile.cohomology;
+  times[5] = profile.complexes.layer_time;
+  times[6] = profile.complexes.build_time;
+  times[7] = profile.complexes.rank_time;
+  *regions = profile.interior;
+  cech_profile_free(&profile);
+
+  n = (bc->k == CECH_ALL_DEGREES) ? fan->dim+1 : 1;
+  result[0] = '\0';
+  for (i=0; i<n; i++)
+    sprintf(result+strlen(result), "%s%d", i ? "," : "", h[i]);
+}
+
+/* Sweep the case with the given traversal, and compare the cohomology
+   at each point of the grid with the one computed for that point
+   alone. The chamber enumeration takes no box, so it gets the one
+   computed instead. Returns the number of points where they
+   differ. */
+static int check_sweep(const sweep_case_t *sc, const cech_options_t *opts,
+		       traversal_mode_t traversal)
+{
+  const bench_fan_t *fan = sc->fan;
+  const int nh = fan->dim+1;
+  cech_options_t sweep_opts = *opts;
+  const int *box = (traversal == TRAVERSE_CHAMBERS) ? NULL : sc->box;
+  cech_fan_t *cf;
+  int divisor[MAX_RAYS], h[MAX_CONE_SIZE+1];
+  int *hs;
+  long npoints, p, rest;
+  int d, i, wrong = 0;
+
+  sweep_opts.traversal = traversal;
+  cf = cech_fan_new(fan->dim, fan->rays, fan->nrays, fan->cone_sizes,
+		    fan->cone_rays, fan->ncones, &sweep_opts);
+  if (!cf) {
+    fprintf(stderr, "ERROR: could not set up the fan of %s\n", sc->name);
+    abort();
+  }
+
+  npoints = 1;
+  for (d=0; d<sc->ndirs; d++)
+    npoints *= sc->dirs[d].hi - sc->dirs[d].lo + 1;
+  hs = malloc(npoints*nh*sizeof(int));
+
+  if (cech_sweep(cf, sc->divisor, box, sc->dirs, sc->ndirs,
+		 CECH_ALL_DEGREES, hs, NULL) != npoints) {
+    fprintf(stderr, "ERROR: could not sweep %s\n", sc->name);
+    abort();
+  }
+
+  for (p=0; p<npoints; p++) {
+    memcpy(divisor, sc->divisor, fan->nrays*sizeof(int));
+    rest = p;
+    for (d=sc->ndirs-1; d>=0; d--) {
+      const int width = sc->dirs[d].hi - sc->dirs[d].lo + 1;
+
+      divisor[sc->dirs[d].ray] += sc->dirs[d].lo + rest%width;
+      rest /= width;
+    }
+
+    cech_compute(cf, divisor, box, CECH_ALL_DEGREES, h, NULL);
+    for (i=0; i<nh; i++) {
+      if (h[i] != hs[p*nh+i]) {
+	fprintf(stderr, "ERROR: the sweep of %s gives h^%d = %d at point "
+		"%ld, but it is %d\n", sc->name, i, hs[p*nh+i], p, h[i]);
+	wrong++;
+      }
+    }
+  }
+
+  free(hs);
+  cech_fan_free(cf);
+
+  return wrong;
+}
+
+/* Run the case a few times, and write out the fastest time of each
+   phase, and how they compare with the baseline, if it has the case.
+   Returns 1 if the result is wrong, 0 otherwise. */
+static int bench_case(const bench_case_t *bc, const cech_options_t *opts,
+		      const char *traversal, int repeats,
+		      const bench_result_t *baseline, int nbaseline)
+{
+  const bench_result_t *b = NULL;
+  double best[NPHASES], times[NPHASES];
+  char result[256];
+  long long regions;
+  int j, r;
+
+  for (r=0; r<repeats; r++) {
+    run_case(bc, opts, times, result, &regions);
+    for (j=0; j<NPHASES; j++) {
+      if (r == 0 || times[j] < best[j])
+	best[j] = times[j];
+    }
+  }
+
+  printf("%s\t%s\t%d\t%s", bc->name, traversal, bc->k, result);
+  for (j=0; j<NPHASES; j++)
+    printf("\t%.6f", best[j]);
+  printf("\n");
+
+  for (j=0; j<nbaseline; j++) {
+    if (!strcmp(baseline[j].name, bc->name) &&
+	!strcmp(baseline[j].traversal, traversal) && baseline[j].k == bc->k)
+      b = &baseline[j];
+  }
+  if (b) {
+    /* Phases too fast to be measured reliably are left out. */
+    printf("# %s (%s) vs baseline:", bc->name, traversal);
+    for (j=0; j<NPHASES; j++) {
+      if (b->times[j] >= 1e-3)
+	printf(" %s %.2fx", phase_names[j], best[j]/b->times[j]);
+    }
+    printf("\n");
+  }
+
+  if (strcmp(result, bc->expected)) {
+    fprintf(stderr, "ERROR: %s (%s) gives %s for k=%d, but it is %s\n",
+	    bc->name, traversal, result, bc->k, bc->expected);
+    return 1;
+  }
+
+  if (regions != bc->regions) {
+    fprintf(stderr, "ERROR: %s (%s) finds %lld compact regions, but there "
+	    "are %lld\n", bc->name, traversal, regions, bc->regions);
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Read the results of a previous run of the benchmarks, as written by
+   main. Returns the number of results read. */
+static int read_baseline(const char *fname, bench_result_t *baseline)
+{
+  FILE *fp = fopen(fname, "r");
+  char line[1024], result[256];
+  int n = 0;
+
+  if (!fp) {
+    fprintf(stderr, "ERROR: could not open %s\n", fname);
+    abort();
+  }
+
+  while (n < NCASES*NTRAVERSALS && fgets(line, sizeof(line), fp)) {
+    bench_result_t *b = &baseline[n];
+    double *t = b->times;
+
+    if (line[0] == '#' || !strncmp(line, "case\t", 5))
+      continue;
+
+    if (sscanf(line, "%63s %15s %d %255s %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+	       b->name, b->traversal, &b->k, result, &t[0], &t[1], &t[2],
+	       &t[3], &t[4], &t[5], &t[6], &t[7], &t[8]) != 4+NPHASES) {
+      fprintf(stderr, "ERROR: invalid line in %s: %s", fname, line);
+      abort();
+    }
+    n++;
+  }
+
+  fclose(fp);
+
+  return n;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-n repeats] [-j threads] [-c baseline.tsv]\n",
+	  argv0);
+  fprintf(stderr, "  -n: runs of each case, the fastest is kept "
+	  "(default 3)\n");
+  fprintf(stderr, "  -j: threads to use, 0 for one per processor "
+	  "(default 1)\n");
+  fprintf(stderr, "  -c: also write the ratio of each time to the one "
+	  "in the\n      output of a previous run\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  bench_result_t baseline[NCASES*NTRAVERSALS];
+  cech_options_t opts;
+  const char *baseline_file = NULL;
+  int repeats = 3, nbaseline = 0, wrong = 0;
+  int c, i, j, t;
+
+  cech_default_options(&opts);
+  opts.cech.backend = BACKEND_RANK;
+
+  while ((c = getopt(argc, argv, "n:j:c:")) != -1) {
+    switch (c) {
+    case 'n':
+      repeats = atoi(optarg);
+      if (repeats < 1)
+	usage(argv[0]);
+      break;
+    case 'j':
+      opts.nthreads = atoi(optarg);
+      break;
+    case 'c':
+      baseline_file = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc)
+    usage(argv[0]);
+
+  if (baseline_file)
+    nbaseline = read_baseline(baseline_file, baseline);
+
+  sixfold_cones(&sixfold);
+
+  printf("# Fastest of %d runs, in seconds. layers, build and rank are "
+	 "added up over threads.\n", repeats);
+  printf("case\ttraversal\tk\tresult");
+  for (j=0; j<NPHASES; j++)
+    printf("\t%s", phase_names[j]);
+  printf("\n");
+
+  for (i=0; i<NCASES; i++) {
+    for (t=0; t<NTRAVERSALS; t++) {
+      if (traversals[t] != TRAVERSE_CHAMBERS && !cases[i].box)
+	continue;
+
+      opts.traversal = traversals[t];
+      wrong += bench_case(&cases[i], &opts, traversal_names[t], repeats,
+			  baseline, nbaseline);
+    }
+  }
+  opts.traversal = TRAVERSE_CHAMBERS;
+
+  for (i=0; i<NSWEEPS; i++) {
+    for (t=0; t<NTRAVERSALS; t++) {
+      int w = check_sweep(&sweeps[i], &opts, traversals[t]);
+
+      printf("# sweep of %s (%s): %s\n", sweeps[i].name, traversal_names[t],
+	     w ? "WRONG" : "ok");
+      wrong += w;
+    }
+  }
+
+  return wrong ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+#ifndef __BITSET_H__
+#define __BITSET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+/* Sets of small non-negative integers (typically ray indices), packed
+   one bit per element into arrays of 64 bit words. The operations on
+   whole sets use SSE2/SSE4.1/AVX2 when the compiler targets them. */
+
+/* Number of words needed to hold n bits. */
+#define BITSET_WORDS(n) (((n)+63)/64)
+
+static inline void bitset_clear(uint64_t *set, int nwords)
+{
+  memset(set, 0, nwords*sizeof(uint64_t));
+}
+
+static inline void bitset_add(uint64_t *set, int i)
+{
+  set[i/64] |= UINT64_C(1) << (i%64);
+}
+
+static inline void bitset_toggle(uint64_t *set, int i)
+{
+  set[i/64] ^= UINT64_C(1) << (i%64);
+}
+
+static inline int bitset_contains(const uint64_t *set, int i)
+{
+  return (set[i/64] >> (i%64)) & 1;
+}
+
+/* dst = a & b. dst may be one of a or b. */
+static inline void bitset_and(uint64_t *dst, const uint64_t *a,
+			      const uint64_t *b, int nwords)
+{
+  int i = 0;
+
+#ifdef __AVX2__
+  for (; i+4<=nwords; i+=4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) &a[i]);
+    __m256i y = _mm256_loadu_si256((const __m256i *) &b[i]);
+
+    _mm256_storeu_si256((__m256i *) &dst[i], _mm256_and_si256(x, y));
+  }
+#endif
+#ifdef __SSE2__
+  for (; i+2<=nwords; i+=2) {
+    __m128i x = _mm_loadu_si128((const __m128i *) &a[i]);
+    __m128i y = _mm_loadu_si128((const __m128i *) &b[i]);
+
+    _mm_storeu_si128((__m128i *) &dst[i], _mm_and_si128(x, y));
+  }
+#endif
+  for (; i<nwords; i++)
+    dst[i] = a[i] & b[i];
+}
+
+/* Nonzero iff a & b is not empty. */
+static inline int bitset_intersects(const uint64_t *a, const uint64_t *b,
+				    int nwords)
+{
+  int i = 0;
+
+#ifdef __AVX2__
+  for (; i+4<=nwords; i+=4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) &a[i]);
+    __m256i y = _mm256_loadu_si256((const __m256i *) &b[i]);
+
+    if (!_mm256_testz_si256(x, y))
+      return 1;
+  }
+#endif
+#ifdef __SSE4_1__
+  for (; i+2<=nwords; i+=2) {
+    __m128i x = _mm_loadu_si128((const __m128i *) &a[i]);
+    __m128i y = _mm_loadu_si128((const __m128i *) &b[i]);
+
+    if (!_mm_testz_si128(x, y))
+      return 1;
+  }
+#endif
+  for (; i<nwords; i++) {
+    if (a[i] & b[i])
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Nonzero iff both sets are equal. */
+static inline int bitset_equal(const uint64_t *a, const uint64_t *b,
+			       int nwords)
+{
+  return !memcmp(a, b, nwords*sizeof(uint64_t));
+}
+
+/* Compare two sets as multi-word integers, most significant word
+   last. Returns -1, 0 or +1 as for qsort. */
+static inline int bitset_compare(const uint64_t *a, const uint64_t *b,
+				 int nwords)
+{
+  int i;
+
+  for (i=nwords-1; i>=0; i--) {
+    if (a[i] != b[i])
+      return (a[i] < b[i]) ? -1 : +1;
+  }
+
+  return 0;
+}
+
+/* The splitmix64 finalizer, used by all the hash tables. */
+static inline uint64_t hash_mix(uint64_t h)
+{
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+
+  return h;
+}
+
+/* Hash n words, mixing each one into h. */
+static inline uint64_t hash_words(uint64_t h, const uint64_t *words,
+				  size_t n)
+{
+  size_t i;
+
+  for (i=0; i<n; i++)
+    h = hash_mix(h ^ words[i]);
+
+  return h;
+}
+
+#endif
@@ -0,0 +1,179 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include "box.h"
+
+static void too_large(void)
+{
+  fprintf(stderr, "ERROR: the vertices of the arrangement are too "
+	  "large to compute the box.\n");
+  abort();
+}
+
+/* Determinant of the n x n matrix a, which is destroyed. This is
+   fraction-free Gaussian elimination (Bareiss), so each intermediate
+   entry is a minor of the original matrix, and all the divisions are
+   exact. */
+static int64_t determinant(int64_t *a, int n)
+{
+  int64_t prev = 1;
+  int sign = 1;
+  int i, j, k;
+
+  for (k=0; k<n; k++) {
+    if (a[k*n+k] == 0) {
+      for (i=k+1; i<n && a[i*n+k] == 0; i++)
+	;
+      if (i == n)
+	return 0;
+
+      for (j=k; j<n; j++) {
+	int64_t t = a[k*n+j];
+
+	a[k*n+j] = a[i*n+j];
+	a[i*n+j] = t;
+      }
+      sign = -sign;
+    }
+
+    for (i=k+1; i<n; i++) {
+      for (j=k+1; j<n; j++) {
+	__int128 x = ((__int128) a[i*n+j]*a[k*n+k] -
+		      (__int128) a[i*n+k]*a[k*n+j]) / prev;
+
+	if (x > INT64_MAX || x < -INT64_MAX)
+	  too_large();
+	a[i*n+j] = x;
+      }
+    }
+
+    prev = a[k*n+k];
+  }
+
+  return sign*a[(n-1)*n+(n-1)];
+}
+
+/* Largest integer not above a/b, and smallest integer not below it,
+   for b > 0. */
+static int64_t floor_div64(int64_t a, int64_t b)
+{
+  return (a >= 0) ? a/b : -((-a+b-1)/b);
+}
+
+static int64_t ceil_div64(int64_t a, int64_t b)
+{
+  return -floor_div64(-a, b);
+}
+
+/* The vertex where the hyperplanes of the rays in chosen meet, if
+   they are independent: by Cramer's rule, m_i = num[i]/den. Returns
+   0 if they are not. */
+static int vertex(int **rays, const int *divisor, const int *chosen,
+		  int dim, int64_t *num, int64_t *den)
+{
+  int64_t a[dim*dim];
+  int i, j, col;
+
+  for (col=-1; col<dim; col++) {
+    int64_t d;
+
+    /* The matrix of the rays, with column col replaced by -a. */
+    for (i=0; i<dim; i++) {
+      for (j=0; j<dim; j++)
+	a[i*dim+j] = (j == col) ? -divisor[chosen[i]] : rays[chosen[i]][j];
+    }
+
+    d = determinant(a, dim);
+
+    if (col < 0) {
+      if (d == 0)
+	return 0;
+      *den = d;
+    } else
+      num[col] = d;
+  }
+
+  if (*den < 0) {
+    *den = -*den;
+    for (i=0; i<dim; i++)
+      num[i] = -num[i];
+  }
+
+  return 1;
+}
+
+void compact_box(int **rays, int nrays, int dim, const int *divisor,
+		 int **box)
+{
+  int64_t lo[dim], hi[dim], num[dim], den = 1;
+  int chosen[dim];
+  int nvertices = 0;
+  int i;
+
+  if (nrays < dim) {
+    fprintf(stderr, "ERROR: the rays do not span the lattice.\n");
+    abort();
+  }
+
+  for (i=0; i<dim; i++)
+    chosen[i] = i;
+
+  /* Go over every dim-subset of the rays, in lexicographic order. A
+     compact region lies in a polytope whose vertices are among the
+     points where dim independent hyperplanes meet. */
+  while (1) {
+    if (vertex(rays, divisor, chosen, dim, num, &den)) {
+      for (i=0; i<dim; i++) {
+	/* The closest integers strictly below and above m_i. */
+	int64_t below = ceil_div64(num[i], den) - 1;
+	int64_t above = floor_div64(num[i], den) + 1;
+
+	if (nvertices == 0 || below < lo[i])
+	  lo[i] = below;
+	if (nvertices == 0 || above > hi[i])
+	  hi[i] = above;
+      }
+      nvertices++;
+    }
+
+    for (i=dim-1; i>=0 && chosen[i] == nrays-dim+i; i--)
+      ;
+    if (i < 0)
+      break;
+
+    chosen[i]++;
+    for (i++; i<dim; i++)
+      chosen[i] = chosen[i-1]+1;
+  }
+
+  if (nvertices == 0) {
+    fprintf(stderr, "ERROR: the rays do not span the lattice.\n");
+    abort();
+  }
+
+  for (i=0; i<dim; i++) {
+    if (lo[i] < INT_MIN || hi[i] > INT_MAX)
+      too_large();
+
+    box[i][0] = lo[i];
+    box[i][1] = hi[i];
+  }
+}
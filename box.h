@@ -0,0 +1,18 @@
+#ifndef __BOX_H__
+#define __BOX_H__
+
+/* Fill box[i][0], box[i][1] with the smallest box containing every
+   compact region of the hyperplane arrangement <m,v_j> = -a_j, where
+   v_j are the rays and a_j the coefficients of the divisor, with one
+   extra layer of points all around. A region reaching that layer is
+   not compact. The converse does not hold: the lattice points of a
+   thin unbounded region may step over the layer, going from inside
+   the box to beyond it without any of them on its boundary. So the
+   traversals check the regions which do not reach the boundary with
+   region_bounded (see chambers.h).
+   The vertices of the arrangement are found with exact integer
+   arithmetic. */
+void compact_box(int **rays, int nrays, int dim, const int *divisor,
+		 int **box);
+
+#endif
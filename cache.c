@@ -0,0 +1,359 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bitset.h"
+#include "cache.h"
+
+/* The file is a sequence of records, each one a header, the negative
+   rays (nwords words), the results (nh ints), zero padding up to a
+   multiple of 8 bytes, and a checksum of everything before it. A
+   record is appended with a single write, holding an exclusive lock
+   on the file, so concurrent writers do not interleave. Readers do not
+   lock, but a record that is still being written fails its checksum,
+   and is picked up later. */
+#define RECORD_MAGIC 0x31434843u /* "CHC1" */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t size; /* Of the whole record, in bytes */
+  uint64_t fan;
+  int32_t k;
+  int32_t nwords;
+  int32_t nh;
+  int32_t reserved;
+} record_header_t;
+
+struct cache_t {
+  int fd;
+  uint64_t fan;
+  int nwords;
+
+  /* The file is mapped read only, and remapped when it grows. */
+  char *map;
+  size_t mapped;
+  /* Records in [0, scanned) have been checked and indexed. */
+  size_t scanned;
+
+  /* Hash table with the offsets (plus one, zero meaning empty) of the
+     records for our fan. nbuckets is a power of two. */
+  size_t *buckets;
+  int nbuckets;
+  int nentries;
+
+  /* The cache is shared by all the threads. */
+  pthread_mutex_t lock;
+};
+
+uint64_t fan_key(uint64_t *const *cone_rays, int ncones, int nwords)
+{
+  uint64_t h = hash_mix(0x9e3779b97f4a7c15ULL ^ ncones);
+  int i;
+
+  for (i=0; i<ncones; i++)
+    h = hash_words(h, cone_rays[i], nwords);
+
+  return h;
+}
+
+static size_t record_size(int nwords, int nh)
+{
+  size_t size = sizeof(record_header_t) + nwords*sizeof(uint64_t)
+    + nh*sizeof(int32_t);
+
+  return ((size+7) & ~(size_t) 7) + sizeof(uint64_t);
+}
+
+static uint64_t hash_key(int k, const uint64_t *negative, int nwords)
+{
+  return hash_words(hash_mix((uint64_t) k), negative, nwords);
+}
+
+static const record_header_t *record_at(const cache_t *cache, size_t offset)
+{
+  return (const record_header_t *) &cache->map[offset];
+}
+
+static const uint64_t *record_negative(const record_header_t *r)
+{
+  return (const uint64_t *) (r+1);
+}
+
+static const int32_t *record_h(const record_header_t *r)
+{
+  return (const int32_t *) (record_negative(r) + r->nwords);
+}
+
+/* Bucket holding the record for (k, negative), or the empty bucket
+   where it should go. */
+static int find_bucket(const cache_t *cache, int k, const uint64_t *negative)
+{
+  int b = hash_key(k, negative, cache->nwords) & (cache->nbuckets-1);
+
+  while (cache->buckets[b]) {
+    const record_header_t *r = record_at(cache, cache->buckets[b]-1);
+
+    if (r->k == k && !memcmp(record_negative(r), negative,
+			     cache->nwords*sizeof(uint64_t)))
+      break;
+
+    b = (b+1) & (cache->nbuckets-1);
+  }
+
+  return b;
+}
+
+static void index_record(cache_t *cache, size_t offset)
+{
+  const record_header_t *r = record_at(cache, offset);
+  int b, i;
+
+  if (r->fan != cache->fan || r->nwords != cache->nwords)
+    return;
+
+  b = find_bucket(cache, r->k, record_negative(r));
+  /* Several processes may have computed the same region, keep the
+     first one. */
+  if (cache->buckets[b])
+    return;
+
+  cache->buckets[b] = offset+1;
+  cache->nentries++;
+
+  /* Keep the load factor below one half. */
+  if (2*cache->nentries > cache->nbuckets) {
+    size_t *old = cache->buckets;
+    int nold = cache->nbuckets;
+
+    cache->nbuckets *= 2;
+    cache->buckets = calloc(cache->nbuckets, sizeof(size_t));
+
+    for (i=0; i<nold; i++) {
+      if (old[i]) {
+	r = record_at(cache, old[i]-1);
+	cache->buckets[find_bucket(cache, r->k, record_negative(r))] = old[i];
+      }
+    }
+
+    free(old);
+  }
+}
+
+/* Index the complete records after the ones already scanned. */
+static void scan_records(cache_t *cache)
+{
+  while (cache->mapped - cache->scanned >= sizeof(record_header_t)) {
+    const record_header_t *r = record_at(cache, cache->scanned);
+    size_t size = r->size;
+    const uint64_t *words = (const uint64_t *) r;
+
+    if (r->magic != RECORD_MAGIC || r->nwords < 0 || r->nh < 0
+	|| r->nwords > 1<<20 || r->nh > 1<<20
+	|| size != record_size(r->nwords, r->nh)
+	|| size > cache->mapped - cache->scanned)
+      break;
+
+    if (hash_words(0, words, size/8 - 1) != words[size/8 - 1])
+      break;
+
+    index_record(cache, cache->scanned);
+    cache->scanned += size;
+  }
+}
+
+/* Pick up whatever other writers appended since we last looked. */
+static void refresh(cache_t *cache)
+{
+  struct stat st;
+
+  if (fstat(cache->fd, &st) < 0 || (size_t) st.st_size <= cache->mapped)
+    return;
+
+  if (cache->map)
+    munmap(cache->map, cache->mapped);
+
+  cache->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cache->fd, 0);
+  if (cache->map == MAP_FAILED) {
+    perror("mmap");
+    abort();
+  }
+  cache->mapped = st.st_size;
+
+  scan_records(cache);
+}
+
+cache_t *cache_open(const char *fname, uint64_t fan, int nwords)
+{
+  cache_t *cache;
+  int fd = open(fname, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+  if (fd < 0) {
+    perror("open");
+    fprintf(stderr, "ERROR: could not open the cache '%s'.\n", fname);
+    return NULL;
+  }
+
+  cache = calloc(1, sizeof(cache_t));
+  cache->fd = fd;
+  cache->fan = fan;
+  cache->nwords = nwords;
+  cache->nbuckets = 64;
+  cache->buckets = calloc(cache->nbuckets, sizeof(size_t));
+  pthread_mutex_init(&cache->lock, NULL);
+
+  flock(fd, LOCK_EX);
+
+  refresh(cache);
+
+  /* Nobody is writing, so anything after the last good record is
+     left over from a writer that died. Drop it, or the records
+     appended after it would never be found. */
+  if (cache->scanned < cache->mapped) {
+    fprintf(stderr, "WARNING: dropping %zu corrupt bytes at the end of "
+	    "the cache '%s'.\n", cache->mapped - cache->scanned, fname);
+
+    if (ftruncate(fd, cache->scanned) < 0)
+      perror("ftruncate");
+
+    munmap(cache->map, cache->mapped);
+    cache->map = NULL;
+    cache->mapped = cache->scanned = 0;
+    cache->nentries = 0;
+    memset(cache->buckets, 0, cache->nbuckets*sizeof(size_t));
+
+    refresh(cache);
+  }
+
+  flock(fd, LOCK_UN);
+
+  return cache;
+}
+
+/* The results for (k, negative), or NULL. */
+static const record_header_t *find_record(const cache_t *cache, int k,
+					  const uint64_t *negative)
+{
+  int b = find_bucket(cache, k, negative);
+
+  return cache->buckets[b] ? record_at(cache, cache->buckets[b]-1) : NULL;
+}
+
+static int lookup(const cache_t *cache, int k, const uint64_t *negative,
+		  int *h, int nh)
+{
+  const record_header_t *r = find_record(cache, k, negative);
+  int i;
+
+  if (r && r->nh == nh) {
+    for (i=0; i<nh; i++)
+      h[i] = record_h(r)[i];
+    return 1;
+  }
+
+  /* A single degree can also come from a computation of all of
+     them. */
+  if (k >= 0 && nh == 1) {
+    r = find_record(cache, -1, negative);
+
+    if (r && k < r->nh) {
+      h[0] = record_h(r)[k];
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int cache_lookup(cache_t *cache, int k, const uint64_t *negative,
+		 int *h, int nh)
+{
+  int found;
+
+  pthread_mutex_lock(&cache->lock);
+
+  found = lookup(cache, k, negative, h, nh);
+  if (!found) {
+    refresh(cache);
+    found = lookup(cache, k, negative, h, nh);
+  }
+
+  pthread_mutex_unlock(&cache->lock);
+
+  return found;
+}
+
+void cache_store(cache_t *cache, int k, const uint64_t *negative,
+		 const int *h, int nh)
+{
+  const size_t size = record_size(cache->nwords, nh);
+  uint64_t words[size/8];
+  record_header_t *r = (record_header_t *) words;
+  int32_t *values;
+  size_t written = 0;
+  int i;
+
+  memset(words, 0, size);
+
+  r->magic = RECORD_MAGIC;
+  r->size = size;
+  r->fan = cache->fan;
+  r->k = (k < 0) ? -1 : k;
+  r->nwords = cache->nwords;
+  r->nh = nh;
+
+  memcpy((uint64_t *) (r+1), negative, cache->nwords*sizeof(uint64_t));
+  values = (int32_t *) ((uint64_t *) (r+1) + cache->nwords);
+  for (i=0; i<nh; i++)
+    values[i] = h[i];
+
+  words[size/8 - 1] = hash_words(0, words, size/8 - 1);
+
+  pthread_mutex_lock(&cache->lock);
+  flock(cache->fd, LOCK_EX);
+
+  while (written < size) {
+    ssize_t n = write(cache->fd, (char *) words + written, size - written);
+
+    if (n < 0) {
+      perror("write");
+      break;
+    }
+
+    written += n;
+  }
+
+  flock(cache->fd, LOCK_UN);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void cache_close(cache_t *cache)
+{
+  if (cache->map)
+    munmap(cache->map, cache->mapped);
+  close(cache->fd);
+  free(cache->buckets);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
@@ -0,0 +1,36 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A persistent cache of the cohomology of the regions of a fan,
+   stored in a file which any number of processes may read and append
+   to at the same time. The cohomology of a region only depends on the
+   fan and on the set of rays where the monomials are negative, so the
+   results are keyed by (fan, k, negative rays). */
+typedef struct cache_t cache_t;
+
+/* Key identifying the fan for the cache, computed from the rays in
+   each of the cones (each a bitset of nwords words). */
+uint64_t fan_key(uint64_t *const *cone_rays, int ncones, int nwords);
+
+/* Open (creating it if needed) the cache in the given file, for the
+   fan with the given key, whose negative ray sets are bitsets of
+   nwords words. Returns NULL, after complaining, if the file cannot
+   be used. */
+cache_t *cache_open(const char *fname, uint64_t fan, int nwords);
+
+/* Look up h^k in the region with the given negative rays. k < 0
+   stands for all of h^0, ..., h^{nh-1} at once. Returns 1 and stores
+   the nh values in h if they are known, returns 0 otherwise. */
+int cache_lookup(cache_t *cache, int k, const uint64_t *negative,
+		 int *h, int nh);
+
+/* Record the result of a computation, as in cache_lookup. */
+void cache_store(cache_t *cache, int k, const uint64_t *negative,
+		 const int *h, int nh);
+
+void cache_close(cache_t *cache);
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef __CECH_H__
+#define __CECH_H__
+
+#include "cohomology.h"
+
+/* The library interface: the cohomology of line bundles on a toric
+   variety, given by arrays in memory. A fan is set up once, and then
+   any number of divisors may be computed on it, from any number of
+   threads at once. The program aborts on internal errors (running out
+   of the memory budget, or a failing homchain), as
+   cech_cohomology does. */
+
+/* Value of k requesting all of H^0, ..., H^dim at once. */
+#define CECH_ALL_DEGREES -1
+
+/* How to find the sign patterns, and their number of points. */
+typedef enum {
+  /* Visit the box one row at a time (traverse_rows). */
+  TRAVERSE_ROWS,
+  /* Visit the box one point at a time (traverse_box). */
+  TRAVERSE_POINTS,
+  /* Enumerate the compact regions of the arrangement (find_chambers).
+     This ignores the box, so an explicit box is rejected. */
+  TRAVERSE_CHAMBERS,
+  /* Visit the box one row at a time when one is given, and enumerate
+     the chambers when the box is computed. */
+  TRAVERSE_AUTO
+} traversal_mode_t;
+
+typedef struct {
+  /* How to compute the cohomology of each region. */
+  cech_config_t cech;
+
+  /* How to find the sign patterns. */
+  traversal_mode_t traversal;
+
+  /* Number of threads to use in each computation, 0 for one per
+     processor. */
+  int nthreads;
+
+  /* Memory the Cech complexes of the computations on the fan may
+     use, in MB, shared between all their threads. 0 for no limit. */
+  long budget;
+
+  /* File holding the results of previous runs, or NULL. */
+  const char *cache;
+
+  /* File keeping the progress of each computation, so that a
+     computation killed halfway is resumed where it was left, or
+     NULL. */
+  const char *journal;
+
+  /* Compute only one region in each orbit of the symmetries of the
+     fan. */
+  int symmetries;
+} cech_options_t;
+
+typedef struct cech_fan_t cech_fan_t;
+
+/* Number of regions kept in cech_profile_t. */
+#define CECH_SLOWEST 10
+
+/* A region whose cohomology took long to compute. */
+typedef struct {
+  double time; /* Seconds */
+  long long npoints; /* Lattice points in the region */
+  /* One character per ray, '-' where the monomials in the region are
+     negative and '+' elsewhere. */
+  char *signs;
+} cech_region_time_t;
+
+/* Where the time of cech_compute goes, in seconds, and what it
+   found, added up over all the calls given the same profile. The
+   times in complexes are added up over the threads computing the
+   regions, the rest is wall clock time. */
+typedef struct {
+  double box; /* Computing the box */
+  double traversal; /* Finding the sign patterns */
+  double orbits; /* Merging the patterns in the same orbit */
+  double cohomology; /* The Cech cohomology of all the regions */
+
+  /* The Cech complexes of the regions computed. */
+  cech_stats_t complexes;
+
+  long long visited; /* Lattice points visited */
+  long long interior; /* Compact regions found */
+  /* Regions dropped as not compact: those touching the box, and the
+     unbounded ones which do not (see compact_box). */
+  long long boundary;
+  /* Regions whose cohomology was computed, at most one per orbit of
+     the symmetries; those found in the cache or the journal are not
+     counted. */
+  long long computed;
+
+  /* The regions that took longest, slowest first. */
+  cech_region_time_t slowest[CECH_SLOWEST];
+  int nslowest;
+} cech_profile_t;
+
+void cech_profile_init(cech_profile_t *profile);
+
+void cech_profile_free(cech_profile_t *profile);
+
+/* The defaults of cech_cohomology: sparse elimination, TRAVERSE_AUTO,
+   one thread, no budget, no cache and symmetries on. */
+void cech_default_options(cech_options_t *opts);
+
+/* Set up the fan in the M lattice of dimension dim, with nrays rays
+   (ray i is rays[i*dim], ..., rays[i*dim+dim-1]) and ncones maximal
+   cones. Cone i has cone_sizes[i] rays, listed one cone after the
+   other in cone_rays. The options are copied. Returns NULL if a ray
+   of a cone does not exist, or the cache or the journal cannot be
+   opened. */
+cech_fan_t *cech_fan_new(int dim, const int *rays, int nrays,
+			 const int *cone_sizes, const int *cone_rays,
+			 int ncones, const cech_options_t *opts);
+
+void cech_fan_free(cech_fan_t *fan);
+
+/* Compute h^kmin, ..., h^kmax of the line bundle with the given
+   divisor (one coefficient per ray), storing h^k in h[k-kmin]. The
+   degrees share the Cech complexes of the regions, of which only the
+   layers C^{kmin-1}, ..., C^{kmax+1} are built. box holds the
+   minimum and maximum of each coordinate, box[2*i] and box[2*i+1],
+   or is NULL to compute it (see compact_box); it must be NULL for
+   TRAVERSE_CHAMBERS. If profile is not NULL (it must have been
+   initialized with cech_profile_init), the time taken is added to
+   it. Returns 0, or -1 if the degrees are out of range (kmin < 0 or
+   kmax < kmin) or a box is given to TRAVERSE_CHAMBERS. */
+int cech_compute_range(cech_fan_t *fan, const int *divisor, const int *box,
+		       int kmin, int kmax, int *h, cech_profile_t *profile);
+
+/* cech_compute_range for the single degree k, or for all of h^0, ...,
+   h^dim if k is CECH_ALL_DEGREES. */
+int cech_compute(cech_fan_t *fan, const int *divisor, const int *box, int k,
+		 int *h, cech_profile_t *profile);
+
+/* Most directions a sweep may have. */
+#define MAX_SWEEP_DIRECTIONS 16
+
+/* A direction of a sweep: the coefficient of the given ray in the
+   divisor runs over base+lo, ..., base+hi. */
+typedef struct {
+  int ray;
+  int lo;
+  int hi;
+} cech_direction_t;
+
+/* Compute the cohomology, as in cech_compute_range, for every divisor
+   in the grid of the base divisor plus t_d in [lo_d, hi_d] times the d-th
+   direction. The results for each point are stored one after the
+   other in h, with the points in lexicographic order of
+   (t_0, ..., t_{ndirs-1}), the last one running fastest. The grid is
+   walked so that a single coefficient moves by one at each step: the
+   cohomology of each region is only computed the first time it is
+   found, and the box is traversed only once, then only the points
+   whose sign flips are visited. If box is NULL, the box used holds the
+   compact regions of all the grid. The chambers cannot be updated
+   incrementally, so with TRAVERSE_CHAMBERS (or TRAVERSE_AUTO and no
+   box) that box is traversed by rows. The journal is not supported.
+   Returns the number of points in the grid, or -1 if the degrees or
+   the directions are out of range, a box is given to
+   TRAVERSE_CHAMBERS, or the fan has a journal. */
+long cech_sweep_range(cech_fan_t *fan, const int *divisor, const int *box,
+		      const cech_direction_t *dirs, int ndirs,
+		      int kmin, int kmax, int *h, cech_profile_t *profile);
+
+/* cech_sweep_range for k, as in cech_compute. */
+long cech_sweep(cech_fan_t *fan, const int *divisor, const int *box,
+		const cech_direction_t *dirs, int ndirs, int k, int *h,
+		cech_profile_t *profile);
+
+#endif
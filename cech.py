@@ -0,0 +1,178 @@
+#########################################################################
+#                                                                       #
+# Python binding for libcech: cohomology of line bundles on toric       #
+# varieties, computed in process. Build the library with               #
+# "make libcech.so".                                                    #
+#                                                                       #
+#########################################################################
+
+import ctypes
+import os
+
+ALL_DEGREES = -1
+
+# Values of backend_t and traversal_mode_t.
+BACKEND_RANK, BACKEND_CHOMP, BACKEND_CHECK = range(3)
+TRAVERSE_ROWS, TRAVERSE_POINTS, TRAVERSE_CHAMBERS, TRAVERSE_AUTO = range(4)
+
+# Same layout as cech_config_t and cech_options_t.
+class _Config(ctypes.Structure):
+    _fields_ = [("backend", ctypes.c_int),
+                ("reduce", ctypes.c_int),
+                ("nthreads", ctypes.c_int)]
+
+class Direction(ctypes.Structure):
+    _fields_ = [("ray", ctypes.c_int),
+                ("lo", ctypes.c_int),
+                ("hi", ctypes.c_int)]
+
+class Options(ctypes.Structure):
+    _fields_ = [("cech", _Config),
+                ("traversal", ctypes.c_int),
+                ("nthreads", ctypes.c_int),
+                ("budget", ctypes.c_long),
+                ("cache", ctypes.c_char_p),
+                ("journal", ctypes.c_char_p),
+                ("symmetries", ctypes.c_int)]
+
+# The library is looked for next to this file, unless LIBCECH says
+# otherwise.
+_lib = ctypes.CDLL(os.environ.get("LIBCECH",
+                                  os.path.join(os.path.dirname(
+                                      os.path.abspath(__file__)),
+                                               "libcech.so")))
+
+_int_p = ctypes.POINTER(ctypes.c_int)
+
+_lib.cech_default_options.argtypes = [ctypes.POINTER(Options)]
+_lib.cech_default_options.restype = None
+_lib.cech_fan_new.argtypes = [ctypes.c_int, _int_p, ctypes.c_int,
+                              _int_p, _int_p, ctypes.c_int,
+                              ctypes.POINTER(Options)]
+_lib.cech_fan_new.restype = ctypes.c_void_p
+_lib.cech_fan_free.argtypes = [ctypes.c_void_p]
+_lib.cech_fan_free.restype = None
+_lib.cech_compute_range.argtypes = [ctypes.c_void_p, _int_p, _int_p,
+                                    ctypes.c_int, ctypes.c_int, _int_p,
+                                    ctypes.c_void_p]
+_lib.cech_compute_range.restype = ctypes.c_int
+_lib.cech_sweep_range.argtypes = [ctypes.c_void_p, _int_p, _int_p,
+                                  ctypes.POINTER(Direction), ctypes.c_int,
+                                  ctypes.c_int, ctypes.c_int, _int_p,
+                                  ctypes.c_void_p]
+_lib.cech_sweep_range.restype = ctypes.c_long
+
+def _ints(values):
+    values = list(values)
+    return (ctypes.c_int * max(len(values), 1))(*values)
+
+def default_options():
+    options = Options()
+    _lib.cech_default_options(ctypes.byref(options))
+    return options
+
+class Fan(object):
+    # rays and cones as in cohomology.py. options is an Options, as
+    # returned by default_options().
+    def __init__(self, rays, cones, options=None):
+        assert all(all(ray < len(rays) for ray in cone) for cone in cones)
+        assert len(cones) > len(rays[0])
+
+        if options is None:
+            options = default_options()
+        # The library copies the options, but not the file names.
+        self._options = options
+
+        self.dim = len(rays[0])
+        self.nrays = len(rays)
+        self._fan = _lib.cech_fan_new(
+            self.dim, _ints(x for ray in rays for x in ray), len(rays),
+            _ints(len(cone) for cone in cones),
+            _ints(ray for cone in cones for ray in cone), len(cones),
+            ctypes.byref(options))
+        if not self._fan:
+            raise ValueError("could not set up the fan")
+
+    # The degrees kmin, ..., kmax computed for k, which is a degree, a
+    # (kmin, kmax) pair or 'all'.
+    def _degrees(self, k):
+        if k == 'all':
+            return 0, self.dim
+        if isinstance(k, tuple):
+            return k
+        return k, k
+
+    # h^k of the line bundle with the given divisor, or the list
+    # [h^kmin, ..., h^kmax] if k is a pair (kmin, kmax), or the list
+    # [h^0, ..., h^dim] if k is 'all'. The degrees of a list share the
+    # parts of the Cech complexes they need. box is a list of (min,
+    # max) pairs, computed from the divisor if not given.
+    def cohomology(self, divisor, k='all', box=None):
+        assert len(divisor) == self.nrays
+
+        kmin, kmax = self._degrees(k)
+        h = (ctypes.c_int * max(kmax-kmin+1, 1))()
+        if box is not None:
+            box = _ints(x for interval in box for x in interval)
+
+        if _lib.cech_compute_range(self._fan, _ints(divisor), box, kmin,
+                                   kmax, h, None) < 0:
+            raise ValueError("wrong degree %s, or a box for the chambers"
+                             % (k,))
+
+        if k == 'all' or isinstance(k, tuple):
+            return list(h)
+        return h[0]
+
+    # The cohomology, as returned by cohomology, for every divisor in
+    # the grid of divisor plus t times the ray for each (ray, lo, hi)
+    # in directions, with lo <= t <= hi. The results are listed in the
+    # order of itertools.product of the ranges. This is much faster
+    # than calling cohomology for each divisor.
+    def sweep(self, divisor, directions, k='all', box=None):
+        assert len(divisor) == self.nrays
+
+        kmin, kmax = self._degrees(k)
+        nh = max(kmax-kmin+1, 1)
+        npoints = 1
+        for ray, lo, hi in directions:
+            npoints *= hi - lo + 1
+        dirs = (Direction * max(len(directions), 1))(*directions)
+        h = (ctypes.c_int * (npoints*nh))()
+        if box is not None:
+            box = _ints(x for interval in box for x in interval)
+
+        if _lib.cech_sweep_range(self._fan, _ints(divisor), box, dirs,
+                                 len(directions), kmin, kmax, h, None) < 0:
+            raise ValueError("wrong degree or directions, a box for "
+                             "the chambers, or a journal")
+
+        if k == 'all' or isinstance(k, tuple):
+            return [list(h[i*nh:(i+1)*nh]) for i in range(npoints)]
+        return list(h)
+
+    def close(self):
+        if self._fan:
+            _lib.cech_fan_free(self._fan)
+            self._fan = None
+
+    def __del__(self):
+        self.close()
+
+# Same as compute_kth_cohomology, compute_cohomology_range and
+# compute_cohomology in cohomology.py.
+def compute_kth_cohomology(rays, cones, divisor, k):
+    return Fan(rays, cones).cohomology(divisor, k)
+
+def compute_cohomology_range(rays, cones, divisor, kmin, kmax):
+    return Fan(rays, cones).cohomology(divisor, (kmin, kmax))
+
+def compute_cohomology(rays, cones, divisor):
+    return Fan(rays, cones).cohomology(divisor, 'all')
+
+## Many divisors on the same fan, for instance for P^2:
+#fan = Fan([[1,0],[0,1],[-1,-1]], [[0,1], [1,2], [2,0]])
+#for a in range(-5, 6):
+#    print fan.cohomology([a,0,0])
+## or, equivalently but faster,
+#print fan.sweep([0,0,0], [(0, -5, 5)])
@@ -0,0 +1,260 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include "bitset.h"
+#include "chambers.h"
+#include "lp.h"
+#include "threadpool.h"
+
+/* Only the lattice points of the regions matter, and <m,v_j> < -a_j
+   is <m,v_j> <= -a_j-1 on them. So each region is replaced by the
+   polyhedron A m <= b with the row
+     v_j m <= -a_j-1 if j is in the pattern,
+    -v_j m <= a_j otherwise,
+   which has the same lattice points and the same recession cone. */
+static void constraint(int **rays, const int *divisor, int dim, int j,
+		       int negative, int64_t *A, int64_t *b)
+{
+  int i;
+
+  for (i=0; i<dim; i++)
+    A[j*dim+i] = negative ? rays[j][i] : -rays[j][i];
+  if (divisor)
+    b[j] = negative ? -divisor[j]-1 : divisor[j];
+}
+
+typedef struct {
+  int **rays;
+  int nrays;
+  int dim;
+  const int *divisor;
+  int nwords;
+
+  /* The compact regions found, as patterns. */
+  uint64_t *masks;
+  int nchambers;
+  int size;
+
+  /* One table of patterns per thread. */
+  pattern_table_t *tables;
+} arrangement_t;
+
+/* Nonzero iff the polyhedron A m <= b (with rows rows) is bounded,
+   that is, no direction r != 0 has A r <= 0. Since the rays span the
+   lattice, such an r has (A r)_j < 0 for some j, so this amounts to
+   the maximum of -sum_j (A r)_j with A r <= 0 being 0. */
+static int bounded(const int64_t *A, int rows, int dim)
+{
+  int64_t zero[rows], c[dim];
+  int i, j;
+
+  for (j=0; j<rows; j++)
+    zero[j] = 0;
+
+  for (i=0; i<dim; i++) {
+    c[i] = 0;
+    for (j=0; j<rows; j++)
+      c[i] -= A[j*dim+i];
+  }
+
+  return lp_maximize(rows, dim, A, zero, c, NULL) == LP_OPTIMAL;
+}
+
+int region_bounded(int **rays, int nrays, int dim, const uint64_t *negative)
+{
+  int64_t A[nrays*dim], b[nrays];
+  int j;
+
+  /* The recession cone does not depend on the divisor. */
+  for (j=0; j<nrays; j++)
+    constraint(rays, NULL, dim, j, bitset_contains(negative, j), A, b);
+
+  return bounded(A, nrays, dim);
+}
+
+/* Split the region given by the first j rows of A, b (with pattern
+   negative on the first j rays) by the hyperplanes of the remaining
+   rays, keeping the compact pieces. */
+static void split(arrangement_t *arr, int j, int64_t *A, int64_t *b,
+		  uint64_t *negative)
+{
+  int side;
+
+  if (j == arr->nrays) {
+    if (!bounded(A, j, arr->dim))
+      return;
+
+    if (arr->nchambers == arr->size) {
+      arr->size = arr->size ? 2*arr->size : 16;
+      arr->masks = realloc(arr->masks,
+			   arr->size*arr->nwords*sizeof(uint64_t));
+    }
+    memcpy(&arr->masks[arr->nchambers*arr->nwords], negative,
+	   arr->nwords*sizeof(uint64_t));
+    arr->nchambers++;
+    return;
+  }
+
+  for (side=0; side<2; side++) {
+    constraint(arr->rays, arr->divisor, arr->dim, j, side, A, b);
+
+    if (lp_maximize(j+1, arr->dim, A, b, NULL, NULL) != LP_OPTIMAL)
+      continue;
+
+    if (side)
+      bitset_add(negative, j);
+    split(arr, j+1, A, b, negative);
+    if (side)
+      bitset_toggle(negative, j);
+  }
+}
+
+/* Number of lattice points in A m <= b with m[0], ..., m[k-1] fixed. */
+static long long count_points(const arrangement_t *arr, const int64_t *A,
+			      const int64_t *b, int k, int64_t *m)
+{
+  const int dim = arr->dim, rows = arr->nrays, n = dim-k;
+  int64_t rest[rows], sub[rows*n], c[n];
+  int64_t lo, hi;
+  rational_t q;
+  long long npoints = 0;
+  int i, j;
+
+  /* What is left of b once the fixed coordinates are moved over. */
+  for (j=0; j<rows; j++) {
+    rest[j] = b[j];
+    for (i=0; i<k; i++)
+      rest[j] -= A[j*dim+i]*m[i];
+  }
+
+  if (k == dim-1) {
+    /* A single coordinate left, each row bounds it on one side. The
+       region is bounded, so both bounds are found. */
+    lo = INT64_MIN;
+    hi = INT64_MAX;
+
+    for (j=0; j<rows; j++) {
+      const int64_t a = A[j*dim+k];
+      rational_t q;
+
+      if (a == 0) {
+	if (rest[j] < 0)
+	  return 0;
+	continue;
+      }
+
+      q.num = (a > 0) ? rest[j] : -rest[j];
+      q.den = (a > 0) ? a : -a;
+
+      if (a > 0 && rational_floor(q) < hi)
+	hi = rational_floor(q);
+      else if (a < 0 && rational_ceil(q) > lo)
+	lo = rational_ceil(q);
+    }
+
+    return (hi >= lo) ? hi-lo+1 : 0;
+  }
+
+  /* The range of m[k] in the slice. */
+  for (j=0; j<rows; j++) {
+    for (i=0; i<n; i++)
+      sub[j*n+i] = A[j*dim+k+i];
+  }
+  for (i=0; i<n; i++)
+    c[i] = 0;
+
+  c[0] = 1;
+  if (lp_maximize(rows, n, sub, rest, c, &q) != LP_OPTIMAL)
+    return 0;
+  hi = rational_floor(q);
+
+  c[0] = -1;
+  lp_maximize(rows, n, sub, rest, c, &q);
+  q.num = -q.num;
+  lo = rational_ceil(q);
+
+  for (m[k]=lo; m[k]<=hi; m[k]++)
+    npoints += count_points(arr, A, b, k+1, m);
+
+  return npoints;
+}
+
+static void count_task(int task, int worker, void *arg)
+{
+  arrangement_t *arr = arg;
+  const uint64_t *negative = &arr->masks[task*arr->nwords];
+  int64_t A[arr->nrays*arr->dim], b[arr->nrays], m[arr->dim];
+  pattern_table_t *table = &arr->tables[worker];
+  long long npoints;
+  int j;
+
+  for (j=0; j<arr->nrays; j++)
+    constraint(arr->rays, arr->divisor, arr->dim, j,
+	       bitset_contains(negative, j), A, b);
+
+  npoints = count_points(arr, A, b, 0, m);
+
+  if (npoints > 0) {
+    int index = add_pattern(table, negative);
+
+    /* The tables count points in ints, and the cohomology is added up
+       in ints too. */
+    if (npoints > INT_MAX - table->npoints[index]) {
+      fprintf(stderr, "ERROR: a region has more than %d points.\n", INT_MAX);
+      abort();
+    }
+    table->npoints[index] += npoints;
+    table->visited += npoints;
+  }
+}
+
+void find_chambers(int **rays, int nrays, int dim, const int *divisor,
+		   int nthreads, pattern_table_t *table)
+{
+  arrangement_t arr = {
+    .rays = rays,
+    .nrays = nrays,
+    .dim = dim,
+    .divisor = divisor,
+    .nwords = BITSET_WORDS(nrays)
+  };
+  int64_t A[nrays*dim], b[nrays];
+  uint64_t negative[arr.nwords];
+  int i;
+
+  bitset_clear(negative, arr.nwords);
+  split(&arr, 0, A, b, negative);
+
+  arr.tables = malloc(nthreads*sizeof(pattern_table_t));
+  for (i=0; i<nthreads; i++)
+    pattern_table_init(&arr.tables[i], nrays);
+
+  run_tasks(nthreads, arr.nchambers, count_task, &arr);
+
+  for (i=0; i<nthreads; i++) {
+    merge_patterns(table, &arr.tables[i]);
+    pattern_table_free(&arr.tables[i]);
+  }
+  free(arr.tables);
+  free(arr.masks);
+
+  sort_patterns(table);
+}
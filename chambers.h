@@ -0,0 +1,26 @@
+#ifndef __CHAMBERS_H__
+#define __CHAMBERS_H__
+
+#include "patterns.h"
+
+/* Fill the table with the sign patterns of the compact regions of the
+   arrangement of hyperplanes <m,v_j> = -a_j, where v_j are the rays
+   and a_j the coefficients of the divisor, together with their number
+   of lattice points. A region is the set of m with <m,v_j> < -a_j
+   exactly for the rays j in its pattern. The regions are enumerated
+   by splitting them one hyperplane at a time, and a region is compact
+   when its recession cone is just the origin, so unlike traversing a
+   box, only the lattice points in compact regions are ever visited.
+   The points are counted in parallel by nthreads threads, and the
+   patterns are left sorted. */
+void find_chambers(int **rays, int nrays, int dim, const int *divisor,
+		   int nthreads, pattern_table_t *table);
+
+/* Nonzero iff the regions with the given pattern (the set of rays j
+   with <m,v_j> < -a_j) are compact, whatever the divisor, that is,
+   iff their recession cone is just the origin. This is the test
+   find_chambers applies; the box traversals use it for the regions
+   which do not reach the boundary of the box. */
+int region_bounded(int **rays, int nrays, int dim, const uint64_t *negative);
+
+#endif
@@ -20,7 +20,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "chomp.h"
 
 #define wrong_input(buf) do {\
@@ -94,7 +97,128 @@ static int process_output(FILE *fd)
   return result;
 }
 
-int run_chomp(const char *fname)
+static void reserve(chomp_block_t *block, size_t n)
+{
+  if (block->len + n <= block->size)
+    return;
+
+  block->size = 2*(block->len + n);
+  block->text = realloc(block->text, block->size);
+}
+
+static void put_string(chomp_block_t *block, const char *s)
+{
+  size_t n = strlen(s);
+
+  reserve(block, n);
+  memcpy(&block->text[block->len], s, n);
+  block->len += n;
+}
+
+/* Append the decimal representation of a non-negative integer. This
+   is called for every entry of every differential, so we avoid the
+   overhead of printf. */
+static void put_int(chomp_block_t *block, unsigned int x)
+{
+  char digits[16];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + x%10;
+    x /= 10;
+  } while (x);
+
+  reserve(block, n);
+  while (n)
+    block->text[block->len++] = digits[--n];
+}
+
+void chomp_boundary(chomp_block_t *block, int element,
+		    const int *targets, const int *coeffs, int n)
+{
+  int i;
+
+  put_string(block, "   boundary ");
+  put_int(block, element+1);
+  put_string(block, " =");
+
+  for (i=0; i<n; i++) {
+    put_string(block, (coeffs[i] > 0) ? " + " : " - ");
+    put_int(block, targets[i]+1);
+  }
+
+  put_string(block, "\n");
+}
+
+void free_chomp_block(chomp_block_t *block)
+{
+  free(block->text);
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t written = write(fd, buf, len);
+
+    if (written < 0) {
+      perror("write");
+      abort();
+    }
+
+    buf += written;
+    len -= written;
+  }
+}
+
+/* An anonymous file to hold the chain complex. It lives in memory,
+   and disappears once closed. It is close-on-exec, so that the
+   homchain processes started by other threads do not keep it open. */
+static int scratch_file(void)
+{
+  int fd = memfd_create("chomp", MFD_CLOEXEC);
+
+  /* Old kernels lack memfd_create, fall back to an unlinked
+     temporary file. */
+  if (fd < 0) {
+    const char *tmpdir = getenv("TMPDIR");
+    char *fname;
+
+    assert(asprintf(&fname, "%s/chomp_XXXXXX", tmpdir ? tmpdir : "/tmp") > 0);
+
+    fd = mkostemp(fname, O_CLOEXEC);
+    if (fd < 0) {
+      perror("mkostemp");
+      fprintf(stderr, "ERROR: could not create '%s'.\n", fname);
+      abort();
+    }
+
+    unlink(fname);
+    free(fname);
+  }
+
+  return fd;
+}
+
+/* Serializes starting homchain, see start_homchain. */
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void set_cloexec(int fd, int cloexec)
+{
+  int flags = fcntl(fd, F_GETFD);
+
+  if (flags < 0 ||
+      fcntl(fd, F_SETFD, cloexec ? (flags | FD_CLOEXEC)
+	    : (flags & ~FD_CLOEXEC)) < 0) {
+    perror("fcntl");
+    abort();
+  }
+}
+
+/* Run homchain on the given file, and parse its output. If fd is not
+   -1 the child inherits it. The scratch files of all the threads are
+   close-on-exec; fd is only made inheritable while popen forks, with
+   the lock held, so no other homchain gets it. */
+static int start_homchain(const char *fname, int fd)
 {
   FILE *homchain;
   char *cmd;
@@ -102,8 +226,22 @@ int run_chomp(const char *fname)
 
   assert(asprintf(&cmd, "homchain -d %s", fname) > 0);
 
+  pthread_mutex_lock(&spawn_lock);
+  if (fd >= 0)
+    set_cloexec(fd, 0);
+
   homchain = popen(cmd, "r");
 
+  if (fd >= 0)
+    set_cloexec(fd, 1);
+  pthread_mutex_unlock(&spawn_lock);
+
+  if (!homchain) {
+    perror("popen");
+    fprintf(stderr, "ERROR: could not run '%s'.\n", cmd);
+    abort();
+  }
+
   result = process_output(homchain);
 
   pclose(homchain);
@@ -112,3 +250,61 @@ int run_chomp(const char *fname)
 
   return result;
 }
+
+int chomp_homology(const int *n, const chomp_block_t *d1,
+		   const chomp_block_t *d2)
+{
+  chomp_block_t header = {NULL, 0, 0};
+  int fd, i, result;
+  char *fname;
+
+  put_string(&header, "chain complex\n\nmax dimension = 2\n\n");
+
+  put_string(&header, "dimension 0: ");
+  put_int(&header, n[0]);
+  put_string(&header, "\n");
+
+  /* The lowest complex has always zero differential */
+  for (i=0; i<n[0]; i++) {
+    put_string(&header, "   boundary ");
+    put_int(&header, i+1);
+    put_string(&header, " = 0\n");
+  }
+
+  fd = scratch_file();
+
+  for (i=1; i<=2; i++) {
+    const chomp_block_t *d = (i == 1) ? d1 : d2;
+
+    put_string(&header, "\ndimension ");
+    put_int(&header, i);
+    put_string(&header, ": ");
+    put_int(&header, n[i]);
+    put_string(&header, "\n");
+
+    write_all(fd, header.text, header.len);
+    header.len = 0;
+
+    write_all(fd, d->text, d->len);
+  }
+
+  write_all(fd, "\n", 1);
+
+  free_chomp_block(&header);
+
+  /* homchain reopens the file through our file descriptor, which it
+     inherits. */
+  assert(asprintf(&fname, "/dev/fd/%d", fd) > 0);
+
+  result = start_homchain(fname, fd);
+
+  free(fname);
+  close(fd);
+
+  return result;
+}
+
+int run_chomp(const char *fname)
+{
+  return start_homchain(fname, -1);
+}
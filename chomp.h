@@ -1,6 +1,30 @@
 #ifndef __CHOMP_H__
 #define __CHOMP_H__
 
+#include <stddef.h>
+
+/* The boundaries of one differential, already formatted as homchain
+   expects them. */
+typedef struct {
+  char *text;
+  size_t len;
+  size_t size; /* Allocated size of text */
+} chomp_block_t;
+
+/* Append the boundary of the given (0-based) element to the block,
+   with the given (0-based) targets and coefficients. */
+void chomp_boundary(chomp_block_t *block, int element,
+		    const int *targets, const int *coeffs, int n);
+
+void free_chomp_block(chomp_block_t *block);
+
+/* Compute H_1 of the chain complex with n[i] generators in dimension
+   i, for 0 <= i <= 2, boundary zero in dimension 0, and the
+   boundaries in dimensions 1 and 2 given by d1 and d2. The complex is
+   streamed to homchain through an anonymous in-memory file. */
+int chomp_homology(const int *n, const chomp_block_t *d1,
+		   const chomp_block_t *d2);
+
 /* Run homchain on the given file, and parse its output. */
 int run_chomp(const char *fname);
 
@@ -18,175 +18,236 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
 #include "cohomology.h"
+#include "bitset.h"
 #include "chomp.h"
+#include "sparse.h"
+#include "arena.h"
+#include "morse.h"
+#include "timing.h"
+
+/* Table of binomial coefficients C(n, m), for 0 <= n <= nmax and
+   0 <= m <= mmax. Coefficients too large for 64 bits are stored as
+   UINT64_MAX. */
+typedef struct {
+  int nmax;
+  int mmax;
+  uint64_t *c; /* C(n, m) is c[n*(mmax+1)+m] */
+} binomials_t;
 
-/* Computes n! */
-static long long unsigned int factorial(int n)
-{
-  if (n<=1)
-    return 1;
-
-  return n*factorial(n-1);
-}
-
-/* Compute n choose m = n!/(m!(n-m)!)*/
-static long long unsigned int choose_m_in_n(int m, int n)
-{
-  int i;
-  long long unsigned int result = 1;
-
-  /* We define (n 0) to be 1. */
-  if (m == 0)
-    return 1;
-
-  for (i=0; i<m; i++)
-    result *= n-i;
-
-  return (result / factorial(m));
-}
-
-/* Returns nonzero iff the given vector contains the given value */
-static int contains(int *v, int len, int t)
+static void init_binomials(binomials_t *b, int nmax, int mmax, arena_t *arena)
 {
-  int i;
-
-  for (i=0; i<len; i++) {
-    if (v[i] == t)
-      return 1;
+  int n, m;
+
+  b->nmax = nmax;
+  b->mmax = mmax;
+  b->c = arena_alloc(arena, (nmax+1)*(mmax+1)*sizeof(uint64_t));
+
+  /* Pascal's triangle, saturating on overflow. */
+  for (n=0; n<=nmax; n++) {
+    for (m=0; m<=mmax; m++) {
+      uint64_t *c = &b->c[n*(mmax+1)+m];
+
+      if (m == 0)
+	*c = 1;
+      else if (n == 0)
+	*c = 0;
+      else {
+	uint64_t x = b->c[(n-1)*(mmax+1)+m-1], y = b->c[(n-1)*(mmax+1)+m];
+
+	if (x == UINT64_MAX || y == UINT64_MAX || x+y < x)
+	  *c = UINT64_MAX;
+	else
+	  *c = x+y;
+      }
+    }
   }
-
-  return 0;
 }
 
-/* Returns the cone given by the rays contained in all the given
-   cones. This allocates a new result. */
-static cone_t *intersect_cones(cone_t **cones, int ncones, int id)
+static inline uint64_t binomial(const binomials_t *b, int n, int m)
 {
-  int i;
-  cone_t *result = malloc(sizeof(cone_t));
-
-  result->id = id;
-  result->nintersections = ncones;
-  result->intersections = malloc(ncones*sizeof(int));
-
-  /* This is slightly memory inefficient, but it saves reallocs. */
-  result->rays = malloc(cones[0]->nrays*sizeof(int));
-  result->nrays = 0;
-
-  for (i=0; i<ncones; i++) {
-    result->intersections[i] = cones[i]->id;
-  }
-
-  for (i=0; i<cones[0]->nrays; i++) {
-    int j;
+  return b->c[n*(b->mmax+1)+m];
+}
 
-    for (j=1; j<ncones; j++) {
-      if (!contains(cones[j]->rays, cones[j]->nrays, cones[0]->rays[i]))
-	break;
-    }
+/* One layer C^p of the Cech complex. Its elements are stored one
+   after the other in flat arrays: element i is the intersection of the
+   cones tuples[i*arity], ..., tuples[i*arity+arity-1] (in increasing
+   order), with rays rays[i*nwords], ..., rays[i*nwords+nwords-1]. The
+   elements are in lexicographic order of their tuples. */
+typedef struct {
+  int n; /* Number of elements */
+  int arity; /* Cones intersected in each element, p+1 */
+  int nwords;
 
-    /* If j == cones the ray is contained in all cones, otherwise the
-       previous loop would have stopped early. */
-    if (j == ncones) {
-      result->rays[result->nrays++] = cones[0]->rays[i];
-    }
-  }
+  int *tuples;
+  uint64_t *rays;
+} layer_t;
 
-  return result;
-}
+/* Called for each element of a layer of the Cech complex, in
+   lexicographic order, with its tuple of cones and its rays. */
+typedef void (*visit_fn_t)(const int *tuple, const uint64_t *rays,
+			   void *arg);
 
 /* We need to pass quite a few parameters to choose_k_cones, so we
    pack them neatley here. */
 typedef struct {
-  cone_t **Cech;
-  /* Number of elements added to the Cech complex */
-  int nitems;
+  visit_fn_t visit;
+  void *arg;
 
-  int *sign_pattern;
+  /* Rays where the monomial is negative. */
+  const uint64_t *negative;
 
-  cone_t **result;
+  int *result; /* Identifiers of the cones chosen so far */
   int nresult; /* Number of cones in the result */
+
+  /* Only choose first cones in [first, last). */
+  int first;
+  int last;
 } choose_params_t;
 
 /*
   Chooses k different cones from the set of cones, storing them in
-  result.
+  result. prefix holds the intersection of the rays of the cones
+  already in result (or NULL if there are none), so each level of the
+  recursion only needs to intersect with one more cone.
 */
 static void choose_k_cones(cone_t **cones, int ncones, int k,
-			   choose_params_t *par)
+			   const uint64_t *prefix, choose_params_t *par)
 {
-  int i;
+  int i = 0, end = ncones-k;
 
-  for (i=0; i<=(ncones-k); i++) {
-    if (k==1) {
-      cone_t *intersection;
-      int j;
+  if (par->nresult == 0) {
+    i = par->first;
+    if (end > par->last-1)
+      end = par->last-1;
+  }
 
-      /* Done choosing, we have all desired cones. Process the
-	 intersection, and add it to the Cech complex if no rays in
-	 the intersection are negative. */
-      par->result[par->nresult] = cones[i];
+  for (; i<=end; i++) {
+    const int nwords = cones[i]->nwords;
+    uint64_t rays[nwords];
 
-      intersection = intersect_cones(par->result, par->nresult+1, par->nitems);
+    if (prefix)
+      bitset_and(rays, prefix, cones[i]->rays, nwords);
+    else
+      memcpy(rays, cones[i]->rays, sizeof(rays));
 
-      for (j=0; j<intersection->nrays; j++) {
-	if (par->sign_pattern[intersection->rays[j]] < 0) {
-	  /* The monomial is not well defined in the intersection, do
-	     not bother with it. */
-	  break;
-	}
-      }
+    par->result[par->nresult] = cones[i]->id;
 
-      if (j == intersection->nrays) {
-	/* The monomial is well defined in this patch, add it to the
-	   complex. */
-	par->Cech[par->nitems++] = intersection;
-      } else
-	free_cone(intersection);
+    if (k==1) {
+      /* Done choosing, we have all desired cones. Visit the
+	 intersection if no rays in the intersection are negative,
+	 otherwise the monomial is not well defined in the
+	 intersection, do not bother with it. */
+      if (!bitset_intersects(rays, par->negative, nwords))
+	par->visit(par->result, rays, par->arg);
     } else {
       /* Not done choosing. Store this cone and select the next
 	 element. */
-      par->result[par->nresult++] = cones[i];
-      choose_k_cones(&cones[i+1], ncones-(i+1), k-1, par);
+      par->nresult++;
+      choose_k_cones(&cones[i+1], ncones-(i+1), k-1, rays, par);
       par->nresult--;
     }
   }
 }
 
-/* Populate one entry of the Chech cochain. The elements of the k-th
-   entry are intersections of k+1 maximal dimensional cones, such that
-   the monomial is well defined for all rays in the cone.  Returns how
-   many elements are in the entry.
-*/
-static int populate_cech(cone_t **Cech, int degree,
-			 int *sign_pattern, cone_t **cones, int ncones)
+/* Visit each element of the k-th entry of the Cech cochain whose
+   first cone is in [first, last). Its elements are intersections of
+   k+1 maximal dimensional cones, such that the monomial is well
+   defined for all rays in the cone. */
+static void visit_cech_range(int degree, const uint64_t *negative,
+			     cone_t **cones, int ncones, int first, int last,
+			     visit_fn_t visit, void *arg)
 {
-  cone_t *cones_to_intersect[degree+1];
+  int cones_to_intersect[degree+2];
   choose_params_t par = {
-    .Cech = Cech,
-    .nitems = 0,
-    .sign_pattern = sign_pattern,
+    .visit = visit,
+    .arg = arg,
+    .negative = negative,
     .result = cones_to_intersect,
-    .nresult = 0
+    .nresult = 0,
+    .first = first,
+    .last = last
   };
 
   /* C^{-1} is slightly special, it just denotes the empty set,
      with zero differential. */
-  if (degree == -1) {
-    par.nitems = 0;
-  } else
-    choose_k_cones(cones, ncones, degree+1, &par);
-  
-  return par.nitems;
+  if (degree >= 0)
+    choose_k_cones(cones, ncones, degree+1, NULL, &par);
+}
+
+static void visit_cech(int degree, const uint64_t *negative,
+		       cone_t **cones, int ncones, visit_fn_t visit, void *arg)
+{
+  visit_cech_range(degree, negative, cones, ncones, 0, ncones, visit, arg);
+}
+
+static void count_element(const int *tuple, const uint64_t *rays, void *arg)
+{
+  (void) tuple;
+  (void) rays;
+
+  (*(long long *) arg)++;
+}
+
+static void store_element(const int *tuple, const uint64_t *rays, void *arg)
+{
+  layer_t *layer = arg;
+
+  memcpy(&layer->tuples[layer->n*layer->arity], tuple,
+	 layer->arity*sizeof(int));
+  memcpy(&layer->rays[layer->n*layer->nwords], rays,
+	 layer->nwords*sizeof(uint64_t));
+  layer->n++;
+}
+
+/* Bytes taken by an array of n elements of the given size, aborting
+   if that does not fit in memory. */
+static size_t array_bytes(long long n, size_t size)
+{
+  if (n < 0 || (unsigned long long) n > SIZE_MAX/size) {
+    fprintf(stderr, "ERROR: cannot allocate %lld elements of %zu bytes.\n",
+	    n, size);
+    abort();
+  }
+
+  return n*size;
+}
+
+/* Populate one entry of the Chech cochain. The layer is first
+   counted, and then its arrays are allocated from the arena with
+   exactly the size needed, and filled. */
+static void populate_cech(layer_t *layer, int degree,
+			  const uint64_t *negative, cone_t **cones, int ncones,
+			  arena_t *arena)
+{
+  long long n = 0;
+
+  visit_cech(degree, negative, cones, ncones, count_element, &n);
+
+  if (n > INT_MAX) {
+    fprintf(stderr, "ERROR: C^%d has %lld elements, too many to store.\n",
+	    degree, n);
+    abort();
+  }
+
+  layer->n = 0;
+  layer->arity = degree+1;
+  layer->nwords = cones[0]->nwords;
+  layer->tuples = arena_alloc(arena, array_bytes(n, layer->arity*sizeof(int)));
+  layer->rays = arena_alloc(arena,
+			    array_bytes(n, layer->nwords*sizeof(uint64_t)));
+
+  visit_cech(degree, negative, cones, ncones, store_element, layer);
 }
 
 /* Return +1 if a>b, -1 if a<b, and 0 if they are equal. The
    comparison proceeds term by term. */
-static int compare(int *a, int *b, int dim)
+static int compare(const int *a, const int *b, int dim)
 {
   int j;
 
@@ -200,21 +261,23 @@ static int compare(int *a, int *b, int dim)
   return 0;
 }
 
-/* Find the given intersection in the given list of cones, starting
-   from start (which is excluded from the search). This assumes that
-   the list of cones is ordered by intersection, which is true by
-   construction in our case. */
-static int find_intersection(int *intersection, int dim,
-			     cone_t **cones, int ncones, int origin)
+/* Find the given intersection in the given layer, starting from
+   start (which is excluded from the search). This assumes that the
+   layer is ordered by intersection, which is true by construction in
+   our case. */
+static int find_intersection(int *intersection, const layer_t *layer,
+			     int origin)
 {
-  int start = origin+1, end = ncones-1;
+  const int dim = layer->arity;
+  const int *tuples = layer->tuples;
+  int start = origin+1, end = layer->n-1;
 
   /* The algorithm below simplifies slightly if we can tell for sure
      that the boundaries of the interval do not match. */
-  if (compare(intersection, cones[start]->intersections, dim) == 0)
+  if (compare(intersection, &tuples[start*dim], dim) == 0)
     return start;
   
-  if (compare(intersection, cones[end]->intersections, dim) == 0)
+  if (compare(intersection, &tuples[end*dim], dim) == 0)
     return end;
 
   while (1) {
@@ -225,7 +288,7 @@ static int find_intersection(int *intersection, int dim,
     /* Bisect and compare */
     midpoint = (start+end)/2;
 
-    switch (compare(intersection, cones[midpoint]->intersections, dim)) {
+    switch (compare(intersection, &tuples[midpoint*dim], dim)) {
     case 1:
       start = midpoint;
       break;
@@ -239,134 +302,587 @@ static int find_intersection(int *intersection, int dim,
   }
 }
 
-/* Build the appropriate differentials in the Cech complex, and
-   output them to CHomP. */
-static void build_differentials(cone_t **from, int nfrom, cone_t **to, int nto,
-				int ncones, FILE *chomp)
+/* Index of the elements of a layer of the Cech complex, by the
+   combinatorial rank of their intersection tuples c_0 < ... < c_{n-1},
+   which is sum_i C(c_i, i+1). This numbers the n-subsets of the cones
+   densely, so lookups take constant time: with a plain table when the
+   layer holds a good fraction of all the possible subsets, and with an
+   open addressing hash table otherwise. */
+typedef struct {
+  /* Position in the layer for each rank, or -1. NULL if hashed. */
+  int *dense;
+
+  /* Hash table from ranks to positions, with nbuckets (a power of
+     two) buckets. Empty buckets have position -1. */
+  uint64_t *keys;
+  int *positions;
+  int nbuckets;
+
+  /* The ranks overflow 64 bits, use find_intersection instead. */
+  int bisect;
+} layer_index_t;
+
+/* Combinatorial rank of the given n-tuple of cones. */
+static uint64_t tuple_rank(const int *tuple, int n, const binomials_t *b)
+{
+  uint64_t rank = 0;
+  int i;
+
+  for (i=0; i<n; i++)
+    rank += binomial(b, tuple[i], i+1);
+
+  return rank;
+}
+
+static int lookup_rank(const layer_index_t *index, uint64_t rank)
+{
+  int b;
+
+  if (index->dense)
+    return index->dense[rank];
+
+  b = hash_mix(rank) & (index->nbuckets-1);
+  while (index->positions[b] >= 0 && index->keys[b] != rank)
+    b = (b+1) & (index->nbuckets-1);
+
+  return index->positions[b];
+}
+
+/* Build the index for the given layer, whose elements are
+   intersections of cones out of ncones. The index is allocated from
+   the arena. */
+static void index_layer(layer_index_t *index, const layer_t *layer,
+			int ncones, const binomials_t *b, arena_t *arena)
+{
+  const int n = layer->arity, nlayer = layer->n;
+  uint64_t total = binomial(b, ncones, n);
+  int i;
+
+  memset(index, 0, sizeof(*index));
+
+  if (total == UINT64_MAX) {
+    index->bisect = 1;
+    return;
+  }
+
+  /* A dense table costs one int per possible subset. Use it if at
+     least one in eight subsets is present in the layer. */
+  if (total <= 8*(uint64_t) nlayer + 64) {
+    index->dense = arena_alloc(arena, total*sizeof(int));
+    for (i=0; i<(int) total; i++)
+      index->dense[i] = -1;
+    for (i=0; i<nlayer; i++)
+      index->dense[tuple_rank(&layer->tuples[i*n], n, b)] = i;
+    return;
+  }
+
+  /* Keep the load factor at most one half. */
+  index->nbuckets = 64;
+  while (index->nbuckets < 2*nlayer)
+    index->nbuckets *= 2;
+
+  index->keys = arena_alloc(arena, index->nbuckets*sizeof(uint64_t));
+  index->positions = arena_alloc(arena, index->nbuckets*sizeof(int));
+  for (i=0; i<index->nbuckets; i++)
+    index->positions[i] = -1;
+
+  for (i=0; i<nlayer; i++) {
+    uint64_t rank = tuple_rank(&layer->tuples[i*n], n, b);
+    int bucket = hash_mix(rank) & (index->nbuckets-1);
+
+    while (index->positions[bucket] >= 0)
+      bucket = (bucket+1) & (index->nbuckets-1);
+
+    index->keys[bucket] = rank;
+    index->positions[bucket] = i;
+  }
+}
+
+/* Build the differential of the Cech complex mapping the elements in
+   from to the elements in to, as a sparse matrix with one row for each
+   element in from, allocated from the arena. index is the index of
+   to. If chomp is not NULL each row is also appended to it, in the
+   format homchain reads, as soon as it is built. */
+static void build_differentials(const layer_t *from, const layer_t *to,
+				const layer_index_t *index,
+				const binomials_t *b, int ncones,
+				sparse_matrix_t *d, chomp_block_t *chomp,
+				arena_t *arena)
 {
   int i;
+  /* Every element in from maps to the intersections with each of the
+     cones not already intersected. */
+  const int n = from->arity, nfrom = from->n;
+  const int nrow = ncones - n;
+  int nentries = 0;
+
+  d->nrows = nfrom;
+  d->ncols = to->n;
+  d->row_start = arena_alloc(arena, array_bytes(nfrom+1, sizeof(int)));
+  d->cols = arena_alloc(arena, array_bytes((long long) nfrom*nrow, sizeof(int)));
+  d->vals = arena_alloc(arena, array_bytes((long long) nfrom*nrow, sizeof(int)));
 
   for (i=0; i<nfrom; i++) {
+    const int *tuple = &from->tuples[i*n];
     int j;
-    int target[from[i]->nintersections+1];
+    int target[n+1];
     int signature = +1;
     int last_find = -1;
-
-    fprintf(chomp, "   boundary %d =", i+1);
-
-    for (j=0; j<=from[i]->nintersections; j++) {
+    int *cols = &d->cols[nentries], *vals = &d->vals[nentries];
+    int nrow_entries = 0;
+    /* The rank of the target of inserting k in position j is
+       low[j] + C(k, j+1) + high[j]. */
+    uint64_t low[n+1], high[n+1];
+
+    low[0] = 0;
+    for (j=0; j<n; j++)
+      low[j+1] = low[j] + binomial(b, tuple[j], j+1);
+    high[n] = 0;
+    for (j=n-1; j>=0; j--)
+      high[j] = high[j+1] + binomial(b, tuple[j], j+2);
+
+    for (j=0; j<=n; j++) {
       int k;
       int min, max;
 
       if (j>0)
-	min = from[i]->intersections[j-1]+1;
+	min = tuple[j-1]+1;
       else
 	min = 0;
 
-      if (j<from[i]->nintersections)
-	max = from[i]->intersections[j]-1;
+      if (j<n)
+	max = tuple[j]-1;
       else
 	max = ncones-1;
 
       for (k=min; k<=max; k++) {
 	int t;
 
+	if (!index->bisect) {
+	  last_find = lookup_rank(index, low[j] + binomial(b, k, j+1) + high[j]);
+	  assert(last_find >= 0);
+
+	  cols[nrow_entries] = last_find;
+	  vals[nrow_entries++] = signature;
+	  continue;
+	}
+
 	for (t=0; t<j; t++)
-	  target[t] = from[i]->intersections[t];
+	  target[t] = tuple[t];
 	target[t] = k;
-	for (t=j; t<from[i]->nintersections; t++)
-	  target[t+1] = from[i]->intersections[t];
+	for (t=j; t<n; t++)
+	  target[t+1] = tuple[t];
 
 	/* We now have built the target differential in
 	   target. Search for it in the destination module. */
-	last_find = find_intersection(target, from[i]->nintersections+1,
-				      to, nto, last_find);
+	last_find = find_intersection(target, to, last_find);
 
-	fprintf(chomp, " %s %d", (signature>0)?"+":"-", last_find+1);
+	cols[nrow_entries] = last_find;
+	vals[nrow_entries++] = signature;
       }
 
       signature = -signature;
     }
 
-    fprintf(chomp, "\n");
+    d->row_start[i] = nentries;
+    nentries += nrow_entries;
+
+    if (chomp)
+      chomp_boundary(chomp, i, cols, vals, nrow_entries);
   }
+
+  d->row_start[nfrom] = nentries;
 }
 
-int compute_kth_cohomology(int k, int *sign_pattern,
-			   cone_t **cones, int ncones)
+/* Append the differential to the input for homchain. Only needed
+   when the differential changed after build_differentials. */
+static void chomp_differential(chomp_block_t *chomp, const sparse_matrix_t *d)
 {
-  FILE *chomp;
   int i;
-  cone_t **Cech[3]; /* C^{k-1}, C^{k}, C^{k+1} */
-  int nCech[3]; /* Elements in the k-th Cech complex */
-  int result;
-  char *fname = "__chomp_input__";
 
-  /* CHomP computes things in terms of chain complexes, instead of
-     cochain complexes. So we have to invert the sense of the arrows,
-     but otherwise things map easily. In particular, we start from
-     the highest node in the Cech complex, C^{k+1}, and call that the
-     zero dimensional space. */
-  chomp = fopen(fname, "wb");
+  for (i=0; i<d->nrows; i++)
+    chomp_boundary(chomp, i, &d->cols[d->row_start[i]],
+		   &d->vals[d->row_start[i]], d->row_start[i+1] - d->row_start[i]);
+}
+
+/* The differential d^p generated directly from the cones, without
+   storing C^p or C^{p+1}. The columns are identified by the
+   lexicographic rank of their tuple among all the (p+2)-subsets of
+   the cones, which is C(ncones, p+2) - 1 - sum_i C(ncones-1-c_i, p+2-i)
+   for the tuple c_0 < ... < c_{p+1}. */
+typedef struct {
+  rank_stream_t *stream;
+  const binomials_t *b;
+  int ncones;
+  int arity; /* p+1 */
+  uint64_t total; /* C(ncones, p+2) */
+  long long nrows; /* Elements of C^p seen */
+  long long nentries; /* Nonzero entries seen */
+
+  /* Seconds spent finding the entries of the rows, and eliminating
+     them. */
+  double build_time;
+  double rank_time;
+} direct_rows_t;
+
+static void direct_row(const int *tuple, const uint64_t *rays, void *arg)
+{
+  direct_rows_t *dr = arg;
+  const binomials_t *b = dr->b;
+  const int n = dr->arity, m = n+1, N = dr->ncones;
+  /* The rank of the target of inserting k in position j is
+     total - 1 - (low[j] + C(N-1-k, m-j) + high[j]). */
+  uint64_t low[n+1], high[n+1];
+  uint64_t cols[N-n];
+  int vals[N-n];
+  int signature = +1;
+  int nentries = 0;
+  double start = wall_time(), built;
+  int j, k;
+
+  (void) rays;
+
+  low[0] = 0;
+  for (j=0; j<n; j++)
+    low[j+1] = low[j] + binomial(b, N-1-tuple[j], m-j);
+  high[n] = 0;
+  for (j=n-1; j>=0; j--)
+    high[j] = high[j+1] + binomial(b, N-1-tuple[j], m-1-j);
+
+  for (j=0; j<=n; j++) {
+    int min = (j>0) ? tuple[j-1]+1 : 0;
+    int max = (j<n) ? tuple[j]-1 : N-1;
+
+    for (k=min; k<=max; k++) {
+      cols[nentries] = dr->total - 1 - (low[j] + binomial(b, N-1-k, m-j) + high[j]);
+      vals[nentries++] = signature;
+    }
+
+    signature = -signature;
+  }
 
-  fprintf(chomp, "chain complex\n\n");
+  built = wall_time();
+  rank_stream_row(dr->stream, cols, vals, nentries);
+  dr->nrows++;
+  dr->nentries += nentries;
 
-  fprintf(chomp, "max dimension = 2\n\n");
+  dr->build_time += built - start;
+  dr->rank_time += wall_time() - built;
+}
 
-  /* Populate the Cech patches */
-  for (i=0; i<3;i++) {
-    /* Maximum possible number of patches. In general not all will be
-       properly defined, this is just the theoretical maximum so we
-       just need to allocate things once. */
-    int nmax = choose_m_in_n(k+i, ncones);
+typedef struct {
+  direct_rows_t rows;
+  int degree;
+  const uint64_t *negative;
+  cone_t **cones;
+
+  /* Rows and entries found in each block. */
+  long long *nrows;
+  long long *nentries;
+
+  /* Seconds spent in each block (over all the primes) going through
+     the elements of C^p, finding the entries of their rows, and
+     eliminating them. */
+  double *layer_times;
+  double *build_times;
+  double *rank_times;
+} direct_differential_t;
+
+/* The rows of the given block, out of nblocks. The blocks are ranges
+   of first cones, holding about the same number of possible tuples
+   each. */
+static void direct_block(rank_stream_t *stream, int block, int nblocks,
+			 void *arg)
+{
+  direct_differential_t *dd = arg;
+  direct_rows_t rows = dd->rows;
+  const binomials_t *b = rows.b;
+  const int N = rows.ncones, n = rows.arity;
+  /* There are C(N-1-i, n-1) n-tuples starting with i. */
+  const uint64_t total = binomial(b, N, n);
+  uint64_t below = 0;
+  double start = wall_time();
+  int first = 0, last;
+
+  while (first < N && below < total/nblocks*block) {
+    below += binomial(b, N-1-first, n-1);
+    first++;
+  }
+  for (last = first; last < N && (block == nblocks-1 ||
+				  below < total/nblocks*(block+1)); last++)
+    below += binomial(b, N-1-last, n-1);
+
+  rows.stream = stream;
+  rows.nrows = 0;
+  rows.nentries = 0;
+  rows.build_time = 0;
+  rows.rank_time = 0;
+
+  visit_cech_range(dd->degree, dd->negative, dd->cones, N, first, last,
+		   direct_row, &rows);
+
+  dd->nrows[block] = rows.nrows;
+  dd->nentries[block] = rows.nentries;
+  dd->layer_times[block] +=
+    wall_time() - start - rows.build_time - rows.rank_time;
+  dd->build_times[block] += rows.build_time;
+  dd->rank_times[block] += rows.rank_time;
+}
 
-    Cech[i] = malloc(sizeof(cone_t*)*nmax);
+static void direct_rows(rank_stream_t *stream, void *arg)
+{
+  direct_block(stream, 0, 1, arg);
+}
 
-    /* Generate all the possible combinations (in a well defined order
-       so we can do binary searches later on). */
-    nCech[i] = populate_cech(Cech[i], k-1+i, sign_pattern,
-			     cones, ncones);
+/* Compute h^k for kmin <= k <= kmax, storing h^k in h[k-kmin]. Each
+   of the layers C^{kmin-1}, ..., C^{kmax+1} and each differential
+   between them is built only once, and shared between the degrees
+   that need it. Everything is allocated from the arena, which is
+   reset before returning.
+
+   The rank computation does not need the layers themselves: the rows
+   of each differential are generated from the cones and eliminated
+   one at a time, with columns identified by their combinatorial
+   rank. The layers are only stored when homchain needs them, when the
+   complex is to be reduced first, or when there are so many cones that
+   the ranks do not fit in 64 bits. */
+static void cech_cohomology(int kmin, int kmax, const uint64_t *negative,
+			    cone_t **cones, int ncones,
+			    const cech_config_t *config, arena_t *arena,
+			    cech_stats_t *stats, int *h)
+{
+  /* Number of layers, C^{kmin-1}, ..., C^{kmax+1} */
+  int nlayers = kmax-kmin+3;
+  int nCech[nlayers]; /* Elements in each layer of the Cech complex */
+  /* The differentials d^{kmin-1}, ..., d^{kmax}, in the format
+     homchain reads. */
+  chomp_block_t chomp[nlayers-1];
+  int rank[nlayers-1];
+  const backend_t backend = config->backend;
+  const int use_rank = (backend == BACKEND_RANK || backend == BACKEND_CHECK);
+  const int use_chomp = (backend == BACKEND_CHOMP || backend == BACKEND_CHECK);
+  int store_layers = use_chomp || config->reduce;
+  long long ncells = 0, nentries = 0;
+  /* Elements of C^p and entries of d^p before the reduction. */
+  long long layer_cells[nlayers], layer_entries[nlayers-1];
+  /* Seconds spent on the layers, the differentials and the ranks. */
+  double layer_time, build_time, rank_time = 0;
+  double start = wall_time(), populated, built;
+  binomials_t binom;
+  int i, k;
+
+  init_binomials(&binom, ncones, kmax+2, arena);
+
+  for (i=0; i<nlayers; i++) {
+    /* Elements of C^p are intersections of p+1 cones. */
+    if (binomial(&binom, ncones, kmin+i) == UINT64_MAX)
+      store_layers = 1;
   }
 
-  /* We now have the elements of the Cech complex in place, let us
-     build the differentials. Recall that we are building a chain
-     complex, so the ordering is different to one in which the Cech
-     complex is usually presented. */
-  for (i=0; i<3; i++) {
-    fprintf(chomp, "dimension %d: %d\n", i, nCech[2-i]);
+  memset(chomp, 0, sizeof(chomp));
 
-    /* The lowest complex has always zero differential */
-    if (i==0) {
-      int j;
+  if (store_layers) {
+    layer_t Cech[nlayers];
+    sparse_matrix_t d[nlayers-1]; /* d^{kmin-1}, ..., d^{kmax} */
 
-      for (j=0; j<nCech[2-i]; j++) {
-	fprintf(chomp, "   boundary %d = 0\n", j+1);
+    /* Populate the Cech patches. All the possible combinations are
+       generated in a well defined order, so we can do binary searches
+       later on. */
+    for (i=0; i<nlayers; i++) {
+      populate_cech(&Cech[i], kmin-1+i, negative, cones, ncones, arena);
+      nCech[i] = layer_cells[i] = Cech[i].n;
+      ncells += nCech[i];
+    }
+
+    populated = wall_time();
+
+    for (i=0; i<nlayers-1; i++) {
+      layer_index_t index;
+
+      index_layer(&index, &Cech[i+1], ncones, &binom, arena);
+
+      /* The reduction changes the differentials, so homchain then
+	 gets them once reduced. */
+      build_differentials(&Cech[i], &Cech[i+1], &index, &binom, ncones,
+			  &d[i], (use_chomp && !config->reduce) ? &chomp[i] : NULL,
+			  arena);
+      layer_entries[i] = d[i].row_start[d[i].nrows];
+      nentries += layer_entries[i];
+    }
+
+    if (config->reduce) {
+      long long npairs = morse_reduce(d, nlayers-1, arena);
+
+      for (i=0; i<nlayers-1; i++)
+	nCech[i] = d[i].nrows;
+      nCech[nlayers-1] = d[nlayers-2].ncols;
+
+      if (stats) {
+	stats->reduced_cells += ncells - 2*npairs;
+	for (i=0; i<nlayers-1; i++)
+	  stats->reduced_entries += d[i].row_start[d[i].nrows];
       }
-    } else {
-      build_differentials(Cech[2-i], nCech[2-i], Cech[3-i], nCech[3-i],
-			  ncones, chomp);
     }
 
-    fprintf(chomp, "\n");
+    built = wall_time();
+
+    for (i=0; i<nlayers-1; i++) {
+      if (use_chomp && config->reduce)
+	chomp_differential(&chomp[i], &d[i]);
+
+      if (use_rank)
+	rank[i] = sparse_rank(&d[i], config->nthreads, arena);
+    }
+
+    layer_time = populated - start;
+    build_time = built - populated;
+    rank_time = wall_time() - built;
+  } else {
+    /* Each element of C^{p+1} is found, its row of d^p computed and
+       eliminated right away; the three are timed separately, and
+       added up over the blocks. */
+    layer_time = build_time = 0;
+
+    for (i=0; i<nlayers-1; i++) {
+      direct_differential_t dd = {
+	.rows = {
+	  .b = &binom,
+	  .ncones = ncones,
+	  .arity = kmin+i,
+	  .total = binomial(&binom, ncones, kmin+i+1)
+	},
+	.degree = kmin-1+i,
+	.negative = negative,
+	.cones = cones
+      };
+
+      /* Small differentials are not worth the threads. */
+      const int nblocks =
+	(binomial(&binom, ncones, kmin+i) >= PARALLEL_ROWS) ? config->nthreads : 1;
+      long long nrows[nblocks > 1 ? nblocks : 1];
+      long long nentries_block[nblocks > 1 ? nblocks : 1];
+      double times[3][nblocks > 1 ? nblocks : 1];
+      int j;
+
+      memset(times, 0, sizeof(times));
+      dd.nrows = nrows;
+      dd.nentries = nentries_block;
+      dd.layer_times = times[0];
+      dd.build_times = times[1];
+      dd.rank_times = times[2];
+
+      if (nblocks > 1)
+	rank[i] = parallel_stream_rank(direct_block, &dd, nblocks, arena,
+				       &rank_time);
+      else
+	rank[i] = stream_rank(direct_rows, &dd, arena);
+
+      nCech[i] = 0;
+      layer_entries[i] = 0;
+      for (j=0; j<(nblocks > 1 ? nblocks : 1); j++) {
+	nCech[i] += nrows[j];
+	layer_entries[i] += nentries_block[j];
+	layer_time += times[0][j];
+	build_time += times[1][j];
+	rank_time += times[2][j];
+      }
+      nentries += layer_entries[i];
+      ncells += layer_cells[i] = nCech[i];
+    }
   }
 
-  fclose(chomp);
+  if (stats) {
+    stats->layer_time += layer_time;
+    stats->build_time += build_time;
+    stats->rank_time += rank_time;
+    stats->cells += ncells;
+    stats->entries += nentries;
+    if (!config->reduce) {
+      stats->reduced_cells += ncells;
+      stats->reduced_entries += nentries;
+    }
+
+    /* The layers are C^{kmin-1}, ..., C^{kmax+1}. */
+    for (i=0; i<nlayers-1; i++) {
+      const int p = kmin-1+i;
+
+      if (p >= 0 && p < STATS_DEGREES) {
+	stats->layer_cells[p] += layer_cells[i];
+	stats->layer_entries[p] += layer_entries[i];
+      }
+    }
+  }
 
-  /* We have all the data in fname, pass this on to CHomP */
-  result = run_chomp(fname);
+  for (k=kmin; k<=kmax; k++) {
+    /* Position of C^k in the list of layers. */
+    int l = k-kmin+1;
 
-  /* Done with the file, clean up. */
-  unlink(fname);
+    if (use_rank) {
+      /* h^k = dim C^k - rank d^k - rank d^{k-1} */
+      h[k-kmin] = nCech[l] - rank[l] - rank[l-1];
+    }
 
-  for (i=0; i<3; i++) {
-    int k;
+    if (use_chomp) {
+      /* CHomP computes things in terms of chain complexes, instead
+	 of cochain complexes. So we have to invert the sense of the
+	 arrows, but otherwise things map easily. In particular, we
+	 start from the highest node in the Cech complex, C^{k+1}, and
+	 call that the zero dimensional space. */
+      int n[3] = {nCech[l+1], nCech[l], nCech[l-1]};
+      int chomp_result = chomp_homology(n, &chomp[l], &chomp[l-1]);
+
+      if (backend == BACKEND_CHECK && chomp_result != h[k-kmin]) {
+	fprintf(stderr, "ERROR: homchain gives h^%d = %d, "
+		"but the rank computation gives %d.\n",
+		k, chomp_result, h[k-kmin]);
+	abort();
+      }
 
-    for (k=0; k<nCech[i]; k++) {
-      free_cone(Cech[i][k]);
+      h[k-kmin] = chomp_result;
     }
+  }
+
+  for (i=0; i<nlayers-1; i++)
+    free_chomp_block(&chomp[i]);
+
+  arena_reset(arena);
+}
 
-    free(Cech[i]);
+void add_stats(cech_stats_t *dst, const cech_stats_t *src)
+{
+  int p;
+
+  dst->cells += src->cells;
+  dst->entries += src->entries;
+  dst->reduced_cells += src->reduced_cells;
+  dst->reduced_entries += src->reduced_entries;
+  for (p=0; p<STATS_DEGREES; p++) {
+    dst->layer_cells[p] += src->layer_cells[p];
+    dst->layer_entries[p] += src->layer_entries[p];
   }
+  dst->layer_time += src->layer_time;
+  dst->build_time += src->build_time;
+  dst->rank_time += src->rank_time;
+}
+
+int compute_kth_cohomology(int k, const uint64_t *negative,
+			   cone_t **cones, int ncones,
+			   const cech_config_t *config, arena_t *arena,
+			   cech_stats_t *stats)
+{
+  int result;
+
+  cech_cohomology(k, k, negative, cones, ncones, config, arena, stats,
+		  &result);
 
   return result;
 }
+
+void compute_cohomology(int kmin, int kmax, const uint64_t *negative,
+			cone_t **cones, int ncones,
+			const cech_config_t *config, arena_t *arena,
+			cech_stats_t *stats, int *h)
+{
+  cech_cohomology(kmin, kmax, negative, cones, ncones, config, arena, stats,
+		  h);
+}
@@ -1,13 +1,18 @@
 #ifndef __COHOMOLOGY_H__
 #define __COHOMOLOGY_H__
 
+#include <stdint.h>
+#include "arena.h"
+
 /* A cone. We could assume that the triangulation is simplicial, but
    it is not hard to keep it general. */
 typedef struct {
   int id; /* Numerical identifier for the cone in its Cech element. */
 
-  int *rays;
-  int nrays;
+  /* The rays in the cone, as a bitset (see bitset.h) of nwords
+     words. */
+  uint64_t *rays;
+  int nwords;
 
   /* We generally construct the cones by intersection of basic
      cones. We store in here which intersections defined the current
@@ -18,8 +23,78 @@ typedef struct {
   int nintersections;
 } cone_t;
 
-int compute_kth_cohomology(int k, int *sign_pattern,
-			   cone_t **cones, int ncones);
+/* How to compute the cohomology of the Cech complex. */
+typedef enum {
+  /* Exact sparse elimination, in process. */
+  BACKEND_RANK,
+  /* Pass the complex to CHomP's homchain. */
+  BACKEND_CHOMP,
+  /* Use both, and abort if they disagree. */
+  BACKEND_CHECK
+} backend_t;
+
+/* How to compute the cohomology of each Cech complex. */
+typedef struct {
+  backend_t backend;
+
+  /* Shrink the complex first (see morse.h). */
+  int reduce;
+
+  /* Blocks the rank of each large differential is split in, to be
+     computed by different threads (see parallel_stream_rank). */
+  int nthreads;
+} cech_config_t;
+
+/* Degrees for which cech_stats_t keeps the size of each layer. */
+#define STATS_DEGREES 16
+
+/* Sizes of the Cech complexes computed, added up. */
+typedef struct {
+  long long cells; /* Elements in the layers */
+  long long entries; /* Nonzero entries in the differentials */
+
+  /* The same, after the reduction (if any). */
+  long long reduced_cells;
+  long long reduced_entries;
+
+  /* Elements of C^p and nonzero entries of d^p: C^p -> C^{p+1},
+     before the reduction, for the differentials computed with
+     0 <= p < STATS_DEGREES. */
+  long long layer_cells[STATS_DEGREES];
+  long long layer_entries[STATS_DEGREES];
+
+  /* Seconds spent finding the elements of the layers, building the
+     differentials (or, when they are not stored, finding the entries
+     of each row) and computing their ranks. The ranks computed in
+     blocks add up the time of all the threads working on them. */
+  double layer_time;
+  double build_time;
+  double rank_time;
+} cech_stats_t;
+
+/* Add the stats in src to dst. */
+void add_stats(cech_stats_t *dst, const cech_stats_t *src);
+
+/* Compute h^k for the region where the monomials are negative exactly
+   on the given set of rays (a bitset of the same size as the rays in
+   the cones). The Cech complex is built in the given arena, which is
+   reset before returning, so it can be reused for the next region
+   without going back to malloc. If stats is not NULL, the sizes of the
+   complex are added to it. */
+int compute_kth_cohomology(int k, const uint64_t *negative,
+			   cone_t **cones, int ncones,
+			   const cech_config_t *config, arena_t *arena,
+			   cech_stats_t *stats);
+
+/* Compute all of h^kmin, ..., h^kmax at once, storing h^k in
+   h[k-kmin]. This is cheaper than calling compute_kth_cohomology for
+   each degree, since each of the layers C^{kmin-1}, ..., C^{kmax+1}
+   and the differentials between them are only built once, and no
+   other layer is built. */
+void compute_cohomology(int kmin, int kmax, const uint64_t *negative,
+			cone_t **cones, int ncones,
+			const cech_config_t *config, arena_t *arena,
+			cech_stats_t *stats, int *h);
 
 /* Frees the memory associated with the cone, including the pointer
    to the structure itself. */
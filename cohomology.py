@@ -7,46 +7,7 @@
 from subprocess import Popen, PIPE
 import os
 
-def choose_k_in_s(k, s):
-    if k == 0:
-        yield []
-        return
-
-    for i in xrange(0,len(s)-(k-1)):
-        for combination in choose_k_in_s(k-1, s[i+1:]):
-            yield [s[i]]+combination
-
-
-def compute_box(rays, divisor):
-    dim = len(rays[0])
-    # min, max
-    boxsize = [(0,0)]*dim
-	
-    for ray_system in choose_k_in_s(dim, zip(rays, divisor)):
-        rays = matrix(CC, [item[0] for item in ray_system])
-        a = matrix(ZZ, [-item[1] for item in ray_system])
-        
-        try:
-            m = rays.inverse()
-        except ZeroDivisionError:
-            # No solution, just try the next collection
-            continue
-
-        solution = m * a.transpose()
-
-        for i in range(dim):
-            m_i = int(RR(real(solution[i][0])))
-            min_m, max_m = boxsize[i]
-            min_m = min(min_m, m_i)
-            max_m = max(max_m, m_i)
-            boxsize[i] = (min_m, max_m)
-		
-    for i in range(dim):
-	boxsize[i] = (boxsize[i][0]-1,boxsize[i][1]+1)
-
-    return boxsize
-
-def compute_kth_cohomology(rays, cones, divisor, k):
+def run_cech_cohomology(rays, cones, divisor, k):
     # Some basic sanity checks.
     assert len(divisor) == len(rays)
     assert all(all(ray < len(rays) for ray in cone) for cone in cones)
@@ -64,12 +25,10 @@ def compute_kth_cohomology(rays, cones, divisor, k):
     # Pass the relevant information to the C code
     fname = tmp_filename()
     fd = open(fname, "wb")
-    box = compute_box(rays, divisor)
-    
-    # Definition of the box.
-    fd.write(str(len(box))+"\n")
-    for interval in box:
-        fd.write("%d %d\n" % interval)
+
+    # The box is computed by cech_cohomology itself.
+    fd.write(str(dim)+"\n")
+    fd.write("auto\n")
 
     # The rays.
     fd.write(str(len(rays))+"\n")
@@ -96,11 +55,94 @@ def compute_kth_cohomology(rays, cones, divisor, k):
     cech = Popen(['cech_cohomology', fname, str(k)], stdout=PIPE)
     
     output, errors = cech.communicate()
-    result = int(output.strip())
 
     os.unlink(fname)
 
-    return result
+    return output
+
+def compute_kth_cohomology(rays, cones, divisor, k):
+    return int(run_cech_cohomology(rays, cones, divisor, k).strip())
+
+# Returns the list [h^kmin, ..., h^kmax], computed in a single run.
+# The degrees share the layers of the Cech complexes, and only
+# C^{kmin-1}, ..., C^{kmax+1} are built.
+def compute_cohomology_range(rays, cones, divisor, kmin, kmax):
+    output = run_cech_cohomology(rays, cones, divisor,
+                                 "%d..%d" % (kmin, kmax))
+    return [int(h) for h in output.split()]
+
+# Returns the list [h^0, ..., h^dim], computed in a single run. H^dim
+# needs C^{dim+1} and d^dim: on fans with many cones these are the
+# largest pieces of the complex, so when only the lower degrees are
+# needed compute_cohomology_range can be much cheaper.
+def compute_cohomology(rays, cones, divisor):
+    output = run_cech_cohomology(rays, cones, divisor, 'all')
+    return [int(h) for h in output.split()]
+
+# Computes the cohomology for each (divisor, k) in requests with a
+# single run of cech_cohomology, which reads the fan only once. k may
+# be 'all', or a pair (kmin, kmax). Returns the list of results, each
+# one as compute_kth_cohomology, compute_cohomology or
+# compute_cohomology_range would return it.
+def compute_cohomologies(rays, cones, requests):
+    assert all(len(divisor) == len(rays) for divisor, k in requests)
+    assert all(all(ray < len(rays) for ray in cone) for cone in cones)
+    assert len(cones) > len(rays[0])
+
+    fname = tmp_filename()
+    fd = open(fname, "wb")
+
+    # The fan: dimension, rays and cones.
+    fd.write(str(len(rays[0]))+"\n")
+    fd.write(str(len(rays))+"\n")
+    for ray in rays:
+        for xi in ray:
+            fd.write("%d " % (xi,))
+        fd.write("\n")
+
+    fd.write(str(len(cones))+"\n")
+    for cone in cones:
+        fd.write("%d\n" % (len(cone),))
+        for ray in cone:
+            fd.write("%d " % (ray,))
+        fd.write("\n")
+
+    fd.close()
+
+    # Each request is k, the box and the divisor.
+    batch = []
+    for divisor, k in requests:
+        if isinstance(k, tuple):
+            batch.append("%d..%d\n" % k)
+        else:
+            batch.append(str(k)+"\n")
+        batch.append("auto\n")
+        batch.append(" ".join(["%d" % (ai,) for ai in divisor])+"\n")
+
+    cech = Popen(['cech_cohomology', '-B', '-', fname], stdin=PIPE,
+                 stdout=PIPE)
+
+    output, errors = cech.communicate("".join(batch))
+
+    os.unlink(fname)
+
+    # If cech_cohomology died partway the output is short, so do not
+    # let zip silently drop the requests left.
+    assert cech.returncode == 0, \
+        "cech_cohomology failed with status %d" % (cech.returncode,)
+    lines = output.splitlines()
+    assert len(lines) == len(requests), \
+        "cech_cohomology gave %d results for %d requests" % (len(lines),
+                                                             len(requests))
+
+    results = []
+    for (divisor, k), line in zip(requests, lines):
+        if k == 'all' or isinstance(k, tuple):
+            results.append([int(h) for h in line.split()])
+        else:
+            results.append(int(line))
+
+    return results
 
 
 
@@ -133,6 +175,15 @@ def compute_kth_cohomology(rays, cones, divisor, k):
     #print "Computing H^{%d}" % (k,)
     #Hk = compute_kth_cohomology(rays, cones, D, k)
     #print "H^{%d} = %d" % (k,Hk)
+## or all of them in a single run, which for small fans like this one
+## is faster, but which always includes the top degrees, the most
+## expensive ones on large fans,
+#print compute_cohomology(rays, cones, D)
+## Many divisors can be done in one go, reading the fan only once.
+#print compute_cohomologies(rays, cones, [(D, 'all'), ([1,1,1,1], 0)])
+## or in process, with no temporary files, using libcech (see cech.py).
+#import cech
+#print cech.Fan(rays, cones).cohomology(D, 'all')
 
 def add(x,y):
 	return [a+b for a,b in zip(x,y)]
@@ -0,0 +1,461 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "bitset.h"
+#include "cache.h"
+#include "journal.h"
+#include "timing.h"
+
+/* The file is a sequence of records, as in the cache (see cache.c):
+   a header, the data, zero padding up to a multiple of 8 bytes, and a
+   checksum of everything before it. Each record is appended with a
+   single write, so a process killed while writing leaves at most an
+   incomplete record at the end, which fails its checksum and is
+   dropped when the journal is opened again.
+
+   The patterns are synced to disk as soon as they are written. Syncing
+   after every result would cost more than computing most regions, so
+   the results are synced at most once every SYNC_INTERVAL seconds,
+   and when the journal is closed. A killed process loses nothing, as
+   the results are already written; a crash of the machine loses at
+   most the last SYNC_INTERVAL seconds. */
+#define JOURNAL_MAGIC 0x314e524au /* "JRN1" */
+#define SYNC_INTERVAL 1.0
+
+enum {
+  /* The data is the points visited (8 bytes), and then for each
+     pattern its negative rays (nwords words), its number of points and
+     its number of points on the boundary (4 bytes each). */
+  RECORD_PATTERNS,
+  /* The data is the nh results of pattern index (4 bytes each). */
+  RECORD_RESULT
+};
+
+typedef struct {
+  uint32_t magic;
+  int32_t type;
+  uint64_t size; /* Of the whole record, in bytes */
+  uint64_t run;
+  int32_t index; /* Pattern of a result */
+  int32_t count; /* Patterns, or results */
+  int32_t nwords;
+  int32_t reserved;
+} record_header_t;
+
+struct journal_t {
+  int fd;
+
+  /* The records found when opening the journal. Those written later
+     are never looked up, as each computation only stores the patterns
+     and the result for each pattern once. */
+  char *data;
+  size_t size;
+
+  /* Hash table with the offsets (plus one, zero meaning empty) of the
+     results in data. nbuckets is a power of two. */
+  size_t *buckets;
+  int nbuckets;
+  int nentries;
+
+  double last_sync;
+  int unsynced;
+
+  /* The journal is shared by all the threads. */
+  pthread_mutex_t lock;
+};
+
+uint64_t journal_key(uint64_t h, const int *values, int n)
+{
+  int i;
+
+  for (i=0; i<n; i++) {
+    const uint64_t v = (uint32_t) values[i];
+
+    h = hash_words(h, &v, 1);
+  }
+
+  return h;
+}
+
+static size_t record_size(size_t data)
+{
+  return sizeof(record_header_t) + ((data+7) & ~(size_t) 7)
+    + sizeof(uint64_t);
+}
+
+static size_t patterns_data(int npatterns, int nwords)
+{
+  return sizeof(int64_t)
+    + npatterns*(nwords*sizeof(uint64_t) + 2*sizeof(int32_t));
+}
+
+static const record_header_t *record_at(const journal_t *journal,
+					size_t offset)
+{
+  return (const record_header_t *) &journal->data[offset];
+}
+
+/* Bucket holding the result of (run, index), or the empty bucket
+   where it should go. */
+static int find_bucket(const journal_t *journal, uint64_t run, int index)
+{
+  const uint64_t key[2] = { run, (uint32_t) index };
+  int b = hash_words(0, key, 2) & (journal->nbuckets-1);
+
+  while (journal->buckets[b]) {
+    const record_header_t *r = record_at(journal, journal->buckets[b]-1);
+
+    if (r->run == run && r->index == index)
+      break;
+
+    b = (b+1) & (journal->nbuckets-1);
+  }
+
+  return b;
+}
+
+static void index_result(journal_t *journal, size_t offset)
+{
+  const record_header_t *r = record_at(journal, offset);
+  int b, i;
+
+  b = find_bucket(journal, r->run, r->index);
+  if (journal->buckets[b])
+    return;
+
+  journal->buckets[b] = offset+1;
+  journal->nentries++;
+
+  /* Keep the load factor below one half. */
+  if (2*journal->nentries > journal->nbuckets) {
+    size_t *old = journal->buckets;
+    int nold = journal->nbuckets;
+
+    journal->nbuckets *= 2;
+    journal->buckets = calloc(journal->nbuckets, sizeof(size_t));
+
+    for (i=0; i<nold; i++) {
+      if (old[i]) {
+	r = record_at(journal, old[i]-1);
+	journal->buckets[find_bucket(journal, r->run, r->index)] = old[i];
+      }
+    }
+
+    free(old);
+  }
+}
+
+/* Size of the valid record at the offset, or 0 if there is none. */
+static size_t check_record(const journal_t *journal, size_t offset)
+{
+  const record_header_t *r = record_at(journal, offset);
+  const size_t left = journal->size - offset;
+  size_t size;
+
+  if (left < sizeof(record_header_t) || r->magic != JOURNAL_MAGIC
+      || r->count < 0 || r->nwords < 0 || r->nwords > 1<<20)
+    return 0;
+
+  if (r->type == RECORD_PATTERNS)
+    size = record_size(patterns_data(r->count, r->nwords));
+  else if (r->type == RECORD_RESULT)
+    size = record_size(r->count*sizeof(int32_t));
+  else
+    return 0;
+
+  if (size != r->size || size > left)
+    return 0;
+
+  if (hash_words(0, (const uint64_t *) r, size/8 - 1) !=
+      ((const uint64_t *) r)[size/8 - 1])
+    return 0;
+
+  return size;
+}
+
+/* Read the whole file. Returns 0 on failure. */
+static int read_journal(journal_t *journal)
+{
+  struct stat st;
+  size_t done = 0;
+
+  if (fstat(journal->fd, &st) < 0) {
+    perror("fstat");
+    return 0;
+  }
+
+  journal->size = st.st_size;
+  /* Records are read as words, so keep the buffer aligned. */
+  journal->data = malloc(journal->size ? journal->size : 1);
+
+  while (done < journal->size) {
+    ssize_t n = pread(journal->fd, journal->data + done,
+		      journal->size - done, done);
+
+    if (n <= 0) {
+      perror("read");
+      return 0;
+    }
+
+    done += n;
+  }
+
+  return 1;
+}
+
+journal_t *journal_open(const char *fname)
+{
+  journal_t *journal;
+  size_t offset = 0, size;
+  int fd = open(fname, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+  if (fd < 0) {
+    perror("open");
+    fprintf(stderr, "ERROR: could not open the journal '%s'.\n", fname);
+    return NULL;
+  }
+
+  if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+    fprintf(stderr, "ERROR: the journal '%s' is in use by another "
+	    "process.\n", fname);
+    close(fd);
+    return NULL;
+  }
+
+  journal = calloc(1, sizeof(journal_t));
+  journal->fd = fd;
+  journal->nbuckets = 64;
+  journal->buckets = calloc(journal->nbuckets, sizeof(size_t));
+  journal->last_sync = wall_time();
+  pthread_mutex_init(&journal->lock, NULL);
+
+  if (!read_journal(journal)) {
+    fprintf(stderr, "ERROR: could not read the journal '%s'.\n", fname);
+    journal_close(journal);
+    return NULL;
+  }
+
+  while ((size = check_record(journal, offset)) > 0) {
+    if (record_at(journal, offset)->type == RECORD_RESULT)
+      index_result(journal, offset);
+    offset += size;
+  }
+
+  /* Anything after the last good record was being written when the
+     previous run was killed. Drop it, or the records appended after
+     it would never be found. */
+  if (offset < journal->size) {
+    fprintf(stderr, "WARNING: dropping %zu incomplete bytes at the end "
+	    "of the journal '%s'.\n", journal->size - offset, fname);
+
+    if (ftruncate(fd, offset) < 0)
+      perror("ftruncate");
+    journal->size = offset;
+  }
+
+  return journal;
+}
+
+int journal_load_patterns(journal_t *journal, uint64_t run,
+			  pattern_table_t *table)
+{
+  size_t offset, size;
+
+  for (offset=0; offset<journal->size; offset+=size) {
+    const record_header_t *r = record_at(journal, offset);
+    const char *p = (const char *) (r+1);
+    int i;
+
+    size = r->size;
+
+    if (r->type != RECORD_PATTERNS || r->run != run ||
+	r->nwords != table->nwords)
+      continue;
+
+    memcpy(&table->visited, p, sizeof(int64_t));
+    p += sizeof(int64_t);
+
+    for (i=0; i<r->count; i++) {
+      int32_t npoints, boundary;
+      int index;
+
+      index = add_pattern(table, (const uint64_t *) p);
+      p += r->nwords*sizeof(uint64_t);
+
+      memcpy(&npoints, p, sizeof(int32_t));
+      memcpy(&boundary, p+sizeof(int32_t), sizeof(int32_t));
+      p += 2*sizeof(int32_t);
+
+      table->npoints[index] = npoints;
+      table->boundary[index] = boundary;
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Sync the journal to disk if it is time to, or if forced. Called with
+   the lock held. */
+static void sync_journal(journal_t *journal, int force)
+{
+  const double now = wall_time();
+
+  if (!journal->unsynced ||
+      (!force && now - journal->last_sync < SYNC_INTERVAL))
+    return;
+
+  if (fsync(journal->fd) < 0)
+    perror("fsync");
+
+  journal->last_sync = now;
+  journal->unsynced = 0;
+}
+
+/* Append the record (of the given size, with the checksum still to be
+   computed) to the journal. */
+static void append(journal_t *journal, uint64_t *words, size_t size,
+		   int force_sync)
+{
+  size_t written = 0;
+
+  words[size/8 - 1] = hash_words(0, words, size/8 - 1);
+
+  pthread_mutex_lock(&journal->lock);
+
+  while (written < size) {
+    ssize_t n = write(journal->fd, (char *) words + written, size - written);
+
+    if (n < 0) {
+      perror("write");
+      fprintf(stderr, "ERROR: could not write to the journal.\n");
+      abort();
+    }
+
+    written += n;
+  }
+
+  journal->unsynced = 1;
+  sync_journal(journal, force_sync);
+
+  pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_store_patterns(journal_t *journal, uint64_t run,
+			    const pattern_table_t *table)
+{
+  const size_t size =
+    record_size(patterns_data(table->npatterns, table->nwords));
+  uint64_t *words = calloc(size/8, sizeof(uint64_t));
+  record_header_t *r = (record_header_t *) words;
+  char *p = (char *) (r+1);
+  int64_t visited = table->visited;
+  int i;
+
+  r->magic = JOURNAL_MAGIC;
+  r->type = RECORD_PATTERNS;
+  r->size = size;
+  r->run = run;
+  r->count = table->npatterns;
+  r->nwords = table->nwords;
+
+  memcpy(p, &visited, sizeof(int64_t));
+  p += sizeof(int64_t);
+
+  for (i=0; i<table->npatterns; i++) {
+    const int32_t npoints = table->npoints[i];
+    const int32_t boundary = table->boundary[i];
+
+    memcpy(p, &table->masks[i*table->nwords],
+	   table->nwords*sizeof(uint64_t));
+    p += table->nwords*sizeof(uint64_t);
+
+    memcpy(p, &npoints, sizeof(int32_t));
+    memcpy(p+sizeof(int32_t), &boundary, sizeof(int32_t));
+    p += 2*sizeof(int32_t);
+  }
+
+  append(journal, words, size, 1);
+
+  free(words);
+}
+
+int journal_lookup(journal_t *journal, uint64_t run, int index,
+		   int *h, int nh)
+{
+  const record_header_t *r;
+  int b, i;
+
+  /* The results found when opening are never modified, so there is no
+     need to lock. */
+  b = find_bucket(journal, run, index);
+  if (!journal->buckets[b])
+    return 0;
+
+  r = record_at(journal, journal->buckets[b]-1);
+  if (r->count != nh)
+    return 0;
+
+  for (i=0; i<nh; i++)
+    h[i] = ((const int32_t *) (r+1))[i];
+
+  return 1;
+}
+
+void journal_store(journal_t *journal, uint64_t run, int index,
+		   const int *h, int nh)
+{
+  const size_t size = record_size(nh*sizeof(int32_t));
+  uint64_t words[size/8];
+  record_header_t *r = (record_header_t *) words;
+  int32_t *values = (int32_t *) (r+1);
+  int i;
+
+  memset(words, 0, size);
+
+  r->magic = JOURNAL_MAGIC;
+  r->type = RECORD_RESULT;
+  r->size = size;
+  r->run = run;
+  r->index = index;
+  r->count = nh;
+
+  for (i=0; i<nh; i++)
+    values[i] = h[i];
+
+  append(journal, words, size, 0);
+}
+
+void journal_close(journal_t *journal)
+{
+  sync_journal(journal, 1);
+
+  close(journal->fd);
+  free(journal->data);
+  free(journal->buckets);
+  pthread_mutex_destroy(&journal->lock);
+  free(journal);
+}
@@ -0,0 +1,45 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdint.h>
+#include "patterns.h"
+
+/* A journal of the progress of long computations, so that they can be
+   resumed after being killed. For each computation (a fan, a divisor,
+   a box, k and the options affecting the patterns found), identified
+   by a key, it holds the table of patterns whose cohomology is to be
+   computed, and the cohomology of each pattern already computed. Only
+   one process may use a journal at a time. */
+typedef struct journal_t journal_t;
+
+/* Extend the key h with the n values. */
+uint64_t journal_key(uint64_t h, const int *values, int n);
+
+/* Open (creating it if needed) the journal in the given file. Returns
+   NULL, after complaining, if the file cannot be used. */
+journal_t *journal_open(const char *fname);
+
+/* Fill the (empty) table with the patterns journaled for the
+   computation, in the order they were stored. Returns 1 if they were
+   found, 0 otherwise. */
+int journal_load_patterns(journal_t *journal, uint64_t run,
+			  pattern_table_t *table);
+
+/* Record the patterns of the computation, syncing them to disk. */
+void journal_store_patterns(journal_t *journal, uint64_t run,
+			    const pattern_table_t *table);
+
+/* Look up the nh values of the cohomology of the pattern at the given
+   position in the table. Returns 1 and stores them in h if they are
+   known, returns 0 otherwise. */
+int journal_lookup(journal_t *journal, uint64_t run, int index,
+		   int *h, int nh);
+
+/* Record the cohomology of a pattern, as in journal_lookup. */
+void journal_store(journal_t *journal, uint64_t run, int index,
+		   const int *h, int nh);
+
+/* Sync what is left to disk and close the journal. */
+void journal_close(journal_t *journal);
+
+#endif
@@ -0,0 +1,343 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "lp.h"
+
+static __int128 gcd(__int128 a, __int128 b)
+{
+  if (a < 0)
+    a = -a;
+  if (b < 0)
+    b = -b;
+
+  while (b != 0) {
+    __int128 t = a % b;
+
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+static rational_t rational(__int128 num, __int128 den)
+{
+  rational_t q;
+  __int128 g;
+
+  if (den < 0) {
+    num = -num;
+    den = -den;
+  }
+
+  g = gcd(num, den);
+  if (g > 1) {
+    num /= g;
+    den /= g;
+  }
+
+  if (num > INT64_MAX || num < -INT64_MAX || den > INT64_MAX) {
+    fprintf(stderr, "ERROR: overflow in the exact linear program.\n");
+    abort();
+  }
+
+  q.num = num;
+  q.den = den;
+
+  return q;
+}
+
+static const rational_t zero = {0, 1};
+
+/* a - f*b */
+static rational_t sub_mul(rational_t a, rational_t f, rational_t b)
+{
+  __int128 den = (__int128) f.den * b.den;
+  __int128 g = gcd(den, a.den);
+
+  /* Use the least common denominator, to keep the terms small. */
+  return rational(a.num * (den/g) - (__int128) f.num * b.num * (a.den/g),
+		  a.den * (den/g));
+}
+
+static rational_t divide(rational_t a, rational_t b)
+{
+  return rational((__int128) a.num * b.den, (__int128) a.den * b.num);
+}
+
+/* Sign of a/b - c/d. */
+static int compare(rational_t a, rational_t b)
+{
+  __int128 x = (__int128) a.num * b.den, y = (__int128) b.num * a.den;
+
+  return (x > y) - (x < y);
+}
+
+/* The simplex tableau. The variables are x_0, ..., x_{n-1} (free),
+   the slacks s_i = b_i - (A x)_i >= 0 with numbers n, ..., n+m-1, and
+   an artificial variable w >= 0, numbered n+m, used to find a first
+   feasible point. Row i reads
+     sum_j T[i][j] var_j = rhs[i],
+   with coefficient 1 for its basic variable basis[i], and 0 for the
+   basic variables of the other rows. The objective row reads
+     z + sum_j obj[j] var_j = objrhs. */
+typedef struct {
+  int m, n, nvars;
+
+  rational_t *T;
+  rational_t *rhs;
+  int *basis;
+  int *dead; /* Redundant rows, ignored */
+
+  rational_t *obj;
+  rational_t objrhs;
+} tableau_t;
+
+#define ENTRY(t, i, j) ((t)->T[(i)*(t)->nvars+(j)])
+
+static void pivot(tableau_t *t, int r, int c)
+{
+  const rational_t p = ENTRY(t, r, c);
+  int i, j;
+
+  for (j=0; j<t->nvars; j++)
+    ENTRY(t, r, j) = divide(ENTRY(t, r, j), p);
+  t->rhs[r] = divide(t->rhs[r], p);
+
+  for (i=0; i<t->m; i++) {
+    const rational_t f = ENTRY(t, i, c);
+
+    if (i == r || t->dead[i] || f.num == 0)
+      continue;
+
+    for (j=0; j<t->nvars; j++) {
+      if (ENTRY(t, r, j).num != 0)
+	ENTRY(t, i, j) = sub_mul(ENTRY(t, i, j), f, ENTRY(t, r, j));
+    }
+    t->rhs[i] = sub_mul(t->rhs[i], f, t->rhs[r]);
+  }
+
+  if (t->obj[c].num != 0) {
+    const rational_t f = t->obj[c];
+
+    for (j=0; j<t->nvars; j++) {
+      if (ENTRY(t, r, j).num != 0)
+	t->obj[j] = sub_mul(t->obj[j], f, ENTRY(t, r, j));
+    }
+    t->objrhs = sub_mul(t->objrhs, f, t->rhs[r]);
+  }
+
+  t->basis[r] = c;
+}
+
+static int is_basic(const tableau_t *t, int var)
+{
+  int i;
+
+  for (i=0; i<t->m; i++) {
+    if (!t->dead[i] && t->basis[i] == var)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Maximize z, starting from a feasible basis. Only the restricted
+   variables below last may enter the basis. */
+static int simplex(tableau_t *t, int last)
+{
+  while (1) {
+    int c, r = -1, i;
+
+    /* Bland's rule: the first improving variable enters, and ties in
+       the ratio test go to the smallest basic variable. */
+    for (c=t->n; c<last; c++) {
+      if (t->obj[c].num < 0 && !is_basic(t, c))
+	break;
+    }
+
+    if (c == last)
+      return LP_OPTIMAL;
+
+    for (i=0; i<t->m; i++) {
+      int cmp;
+
+      if (t->dead[i] || t->basis[i] < t->n || ENTRY(t, i, c).num <= 0)
+	continue;
+
+      if (r >= 0)
+	cmp = compare(divide(t->rhs[i], ENTRY(t, i, c)),
+		      divide(t->rhs[r], ENTRY(t, r, c)));
+      if (r < 0 || cmp < 0 || (cmp == 0 && t->basis[i] < t->basis[r]))
+	r = i;
+    }
+
+    if (r < 0)
+      return LP_UNBOUNDED;
+
+    pivot(t, r, c);
+  }
+}
+
+/* Set the objective to maximize sum_j c[j] var_j, over the first nc
+   variables, in terms of the nonbasic variables. c may be NULL for
+   0. */
+static void set_objective(tableau_t *t, const int64_t *c, int nc)
+{
+  int i, j;
+
+  for (j=0; j<t->nvars; j++)
+    t->obj[j] = rational((c && j < nc) ? -c[j] : 0, 1);
+  t->objrhs = zero;
+
+  for (i=0; i<t->m; i++) {
+    const int b = t->basis[i];
+    const rational_t f = t->obj[b];
+
+    if (t->dead[i] || f.num == 0)
+      continue;
+
+    for (j=0; j<t->nvars; j++) {
+      if (ENTRY(t, i, j).num != 0)
+	t->obj[j] = sub_mul(t->obj[j], f, ENTRY(t, i, j));
+    }
+    t->objrhs = sub_mul(t->objrhs, f, t->rhs[i]);
+  }
+}
+
+static int solve(tableau_t *t, const int64_t *c, rational_t *value)
+{
+  const int n = t->n, m = t->m, w = n+m;
+  int i, j, r;
+
+  /* Bring the free variables into the basis, they never leave it. */
+  for (j=0; j<n; j++) {
+    for (i=0; i<m && (t->basis[i] < n || ENTRY(t, i, j).num == 0); i++)
+      ;
+    if (i < m)
+      pivot(t, i, j);
+  }
+
+  /* Find a feasible basis: relax every restricted row by w, make the
+     most infeasible row feasible by bringing w in, and then minimize
+     w. */
+  r = -1;
+  for (i=0; i<m; i++) {
+    if (t->basis[i] >= n) {
+      ENTRY(t, i, w) = rational(-1, 1);
+      if (r < 0 || compare(t->rhs[i], t->rhs[r]) < 0)
+	r = i;
+    }
+  }
+
+  if (r >= 0 && t->rhs[r].num < 0) {
+    int64_t minus_w[t->nvars];
+
+    pivot(t, r, w);
+
+    for (j=0; j<t->nvars; j++)
+      minus_w[j] = (j == w) ? -1 : 0;
+    set_objective(t, minus_w, t->nvars);
+
+    simplex(t, w+1);
+
+    if (t->objrhs.num < 0)
+      return LP_INFEASIBLE;
+
+    /* w = 0, take it out of the basis if it is still there. */
+    for (i=0; i<m; i++) {
+      if (t->dead[i] || t->basis[i] != w)
+	continue;
+
+      for (j=n; j<w && ENTRY(t, i, j).num == 0; j++)
+	;
+      if (j < w)
+	pivot(t, i, j);
+      else
+	t->dead[i] = 1;
+    }
+  }
+
+  set_objective(t, c, n);
+
+  /* A free variable which could not enter the basis does not appear
+     in any constraint. */
+  for (j=0; j<n; j++) {
+    if (t->obj[j].num != 0 && !is_basic(t, j))
+      return LP_UNBOUNDED;
+  }
+
+  if (simplex(t, w) == LP_UNBOUNDED)
+    return LP_UNBOUNDED;
+
+  if (value)
+    *value = t->objrhs;
+
+  return LP_OPTIMAL;
+}
+
+int lp_maximize(int m, int n, const int64_t *A, const int64_t *b,
+		const int64_t *c, rational_t *value)
+{
+  tableau_t t;
+  int i, j, result;
+
+  t.m = m;
+  t.n = n;
+  t.nvars = n+m+1;
+  t.T = malloc(m*t.nvars*sizeof(rational_t));
+  t.rhs = malloc(m*sizeof(rational_t));
+  t.basis = malloc(m*sizeof(int));
+  t.dead = calloc(m, sizeof(int));
+  t.obj = malloc(t.nvars*sizeof(rational_t));
+
+  /* A x + s = b, with the slacks as the first basis. */
+  for (i=0; i<m; i++) {
+    for (j=0; j<t.nvars; j++)
+      ENTRY(&t, i, j) = zero;
+    for (j=0; j<n; j++)
+      ENTRY(&t, i, j) = rational(A[i*n+j], 1);
+    ENTRY(&t, i, n+i) = rational(1, 1);
+    t.rhs[i] = rational(b[i], 1);
+    t.basis[i] = n+i;
+  }
+  for (j=0; j<t.nvars; j++)
+    t.obj[j] = zero;
+  t.objrhs = zero;
+
+  result = solve(&t, c, value);
+
+  free(t.T);
+  free(t.rhs);
+  free(t.basis);
+  free(t.dead);
+  free(t.obj);
+
+  return result;
+}
+
+int64_t rational_floor(rational_t q)
+{
+  return (q.num >= 0) ? q.num/q.den : -((-q.num+q.den-1)/q.den);
+}
+
+int64_t rational_ceil(rational_t q)
+{
+  return (q.num >= 0) ? (q.num+q.den-1)/q.den : -(-q.num/q.den);
+}
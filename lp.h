@@ -0,0 +1,32 @@
+#ifndef __LP_H__
+#define __LP_H__
+
+#include <stdint.h>
+
+/* An exact rational number num/den, with den > 0 and no common
+   factors. */
+typedef struct {
+  int64_t num;
+  int64_t den;
+} rational_t;
+
+/* Outcome of lp_maximize. */
+enum {
+  LP_OPTIMAL,
+  LP_INFEASIBLE,
+  LP_UNBOUNDED
+};
+
+/* Maximize c.x over the x in R^n with A x <= b, where A is an m x n
+   matrix stored by rows. This is the simplex method in exact rational
+   arithmetic, with Bland's rule, so it always terminates. The maximum
+   is stored in value (if not NULL) when the result is LP_OPTIMAL. The
+   program aborts if an intermediate value does not fit in 64 bits. */
+int lp_maximize(int m, int n, const int64_t *A, const int64_t *b,
+		const int64_t *c, rational_t *value);
+
+/* Largest integer not above q, and smallest integer not below it. */
+int64_t rational_floor(rational_t q);
+int64_t rational_ceil(rational_t q);
+
+#endif
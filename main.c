@@ -0,0 +1,740 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "cech.h"
+#include "timing.h"
+
+#define wrong_input(buf) do {\
+  fprintf(stderr, "[%s:%d] Wrong input!!\n", __FILE__, __LINE__);\
+  fprintf(stderr, "<<%s>>\n", buf);				 \
+  abort();} while(0)
+
+/* The fan as read from the input file, in the form cech_fan_new
+   takes it. */
+typedef struct {
+  int dim; /* Dimension of the M lattice */
+
+  int *rays; /* nrays*dim entries */
+  int nrays;
+
+  int *cone_sizes;
+  int *cone_rays;
+  int ncones;
+} fan_info_t;
+
+/* What --stats reports, added up over all the requests. */
+typedef struct {
+  FILE *out;
+  int nrequests;
+
+  double parse; /* Reading the input */
+  double setup; /* Setting up the fan */
+  cech_profile_t profile; /* Everything else */
+} run_stats_t;
+
+/* Write the stats as a JSON object. */
+static void write_stats(const run_stats_t *stats, double total)
+{
+  const cech_profile_t *profile = &stats->profile;
+  const cech_stats_t *cx = &profile->complexes;
+  FILE *out = stats->out;
+  int i, first = 1;
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"requests\": %d,\n", stats->nrequests);
+
+  /* Seconds. The ones of the Cech complexes are added up over the
+     threads, the rest are wall clock time. */
+  fprintf(out, "  \"time\": {\n");
+  fprintf(out, "    \"total\": %.6f,\n", total);
+  fprintf(out, "    \"parse\": %.6f,\n", stats->parse);
+  fprintf(out, "    \"setup\": %.6f,\n", stats->setup);
+  fprintf(out, "    \"box\": %.6f,\n", profile->box);
+  fprintf(out, "    \"traversal\": %.6f,\n", profile->traversal);
+  fprintf(out, "    \"orbits\": %.6f,\n", profile->orbits);
+  fprintf(out, "    \"cohomology\": %.6f,\n", profile->cohomology);
+  fprintf(out, "    \"cech_layers\": %.6f,\n", cx->layer_time);
+  fprintf(out, "    \"differentials\": %.6f,\n", cx->build_time);
+  fprintf(out, "    \"rank\": %.6f\n", cx->rank_time);
+  fprintf(out, "  },\n");
+
+  fprintf(out, "  \"points_visited\": %lld,\n", profile->visited);
+  fprintf(out, "  \"patterns\": {\"interior\": %lld, \"boundary\": %lld, "
+	  "\"computed\": %lld},\n", profile->interior, profile->boundary,
+	  profile->computed);
+
+  fprintf(out, "  \"cech\": {\n");
+  fprintf(out, "    \"cells\": %lld,\n", cx->cells);
+  fprintf(out, "    \"entries\": %lld,\n", cx->entries);
+  fprintf(out, "    \"reduced_cells\": %lld,\n", cx->reduced_cells);
+  fprintf(out, "    \"reduced_entries\": %lld,\n", cx->reduced_entries);
+  fprintf(out, "    \"degrees\": [");
+  for (i=0; i<STATS_DEGREES; i++) {
+    if (!cx->layer_cells[i] && !cx->layer_entries[i])
+      continue;
+    fprintf(out, "%s\n      {\"degree\": %d, \"cells\": %lld, "
+	    "\"entries\": %lld}", first ? "" : ",", i, cx->layer_cells[i],
+	    cx->layer_entries[i]);
+    first = 0;
+  }
+  fprintf(out, "%s]\n", first ? "" : "\n    ");
+  fprintf(out, "  },\n");
+
+  fprintf(out, "  \"slowest_regions\": [");
+  for (i=0; i<profile->nslowest; i++) {
+    const cech_region_time_t *r = &profile->slowest[i];
+
+    fprintf(out, "%s\n    {\"time\": %.6f, \"points\": %lld, "
+	    "\"signs\": \"%s\"}", i ? "," : "", r->time, r->npoints,
+	    r->signs);
+  }
+  fprintf(out, "%s]\n", profile->nslowest ? "\n  " : "");
+  fprintf(out, "}\n");
+  fflush(out);
+}
+
+/* Read the box, dim lines with the minimum and maximum of each
+   coordinate, or a single line with 'auto'. In the latter case NULL
+   is returned, and the box is computed once the divisor is known. */
+static int *read_box(FILE *fd, int dim)
+{
+  int *box;
+  char *line = NULL;
+  size_t nline = 0;
+  int i;
+
+  if (getline(&line, &nline, fd) < 0)
+    wrong_input(line);
+
+  if (!strncmp(line + strspn(line, " \t"), "auto", 4)) {
+    free(line);
+    return NULL;
+  }
+
+  box = malloc(2*dim*sizeof(int));
+
+  for (i=0; i<dim; i++) {
+    if (i > 0 && getline(&line, &nline, fd) < 0)
+      wrong_input(line);
+
+    if (sscanf(line, "%d %d", &box[2*i], &box[2*i+1]) != 2)
+      wrong_input(line);
+  }
+
+  free(line);
+
+  return box;
+}
+
+/* Read the number of rays, and then one line for each ray. */
+static void read_rays(FILE *fd, fan_info_t *fan)
+{
+  char *line = NULL;
+  size_t nline = 0;
+  int i;
+
+  if (getline(&line, &nline, fd) < 0)
+    wrong_input(line);
+
+  if (sscanf(line, "%d\n", &fan->nrays) != 1)
+    wrong_input(line);
+
+  fan->rays = malloc(fan->nrays*fan->dim*sizeof(int));
+
+  for (i=0; i<fan->nrays; i++) {
+    char *ptr;
+    int j;
+
+    if (getline(&line, &nline, fd) < 0)
+      wrong_input(line);
+
+    ptr = line;
+
+    for (j=0; j<fan->dim; j++) {
+      char *p;
+
+      fan->rays[i*fan->dim+j] = strtol(ptr, &p, 10);
+
+      if (ptr == p)
+	wrong_input(line);
+
+      ptr = p;
+    }
+  }
+
+  free(line);
+}
+
+/* Read the coefficient of the divisor of each ray, in one line. */
+static int *read_divisor(FILE *fd, int nrays)
+{
+  int *divisor = malloc(nrays*sizeof(int));
+  char *line = NULL, *ptr;
+  size_t nline = 0;
+  int i;
+
+  if (getline(&line, &nline, fd) < 0)
+    wrong_input(line);
+
+  ptr = line;
+
+  for (i=0; i<nrays; i++) {
+    char *p;
+
+    divisor[i] = strtol(ptr, &p, 10);
+    
+    if (ptr == p)
+      wrong_input(line);
+    
+    ptr = p;
+  }
+
+  free(line);
+
+  return divisor;
+}
+
+/* Read the number of cones, and then for each cone a line with its
+   number of rays, and a line with the rays. */
+static void read_cones(FILE *fd, fan_info_t *fan)
+{
+  char *line = NULL;
+  size_t nline = 0;
+  int i, next = 0, size = 0;
+
+  if (getline(&line, &nline, fd) < 0)
+    wrong_input(line);
+
+  if (sscanf(line, "%d\n", &fan->ncones) != 1)
+    wrong_input(line);
+
+  fan->cone_sizes = malloc(fan->ncones*sizeof(int));
+  fan->cone_rays = NULL;
+
+  for (i=0; i<fan->ncones; i++) {
+    char *ptr;
+    int j;
+
+    if (getline(&line, &nline, fd) < 0)
+      wrong_input(line);
+
+    if (sscanf(line, "%d\n", &fan->cone_sizes[i]) != 1 ||
+	fan->cone_sizes[i] < 0)
+      wrong_input(line);
+
+    if (next + fan->cone_sizes[i] > size) {
+      size = 2*(next + fan->cone_sizes[i]);
+      fan->cone_rays = realloc(fan->cone_rays, size*sizeof(int));
+    }
+
+    if (getline(&line, &nline, fd) < 0)
+      wrong_input(line);
+
+    ptr = line;
+
+    for (j=0; j<fan->cone_sizes[i]; j++) {
+      char *p;
+      int ray = strtol(ptr, &p, 10);
+
+      if (ptr == p || ray < 0 || ray >= fan->nrays)
+	wrong_input(line);
+
+      fan->cone_rays[next++] = ray;
+
+      ptr = p;
+    }
+  }
+
+  free(line);
+}
+
+static void free_fan_info(fan_info_t *fan)
+{
+  free(fan->rays);
+  free(fan->cone_sizes);
+  free(fan->cone_rays);
+}
+
+static cech_fan_t *make_fan(const fan_info_t *info, const cech_options_t *opts)
+{
+  cech_fan_t *fan = cech_fan_new(info->dim, info->rays, info->nrays,
+				 info->cone_sizes, info->cone_rays,
+				 info->ncones, opts);
+
+  /* The input was checked while reading it, so only the cache or the
+     journal can have failed to open, which has been reported already.
+     That is not a bug, so there is no need for a core dump. */
+  if (!fan)
+    exit(1);
+
+  return fan;
+}
+
+/* The degrees and the directions of the sweeps have been checked
+   already, so the computation can only refuse the box: the chamber
+   enumeration would ignore it. */
+static void chamber_box_error(void)
+{
+  fprintf(stderr, "ERROR: '-t chamber' ignores the box, so the box "
+	  "must be 'auto'.\n");
+  exit(1);
+}
+
+/* Compute the cohomology of the line bundle with the given divisor,
+   counting the monomials in the given box, and print it, in a single
+   line. kmin, ..., kmax are the degrees we are interested in, or kmin
+   is CECH_ALL_DEGREES for all of them. */
+static void box_cohomology(cech_fan_t *fan, int dim, const int *box,
+			   const int *divisor, int kmin, int kmax,
+			   run_stats_t *stats)
+{
+  int *result;
+  int i;
+
+  if (kmin == CECH_ALL_DEGREES) {
+    kmin = 0;
+    kmax = dim;
+  }
+
+  result = malloc((kmax-kmin+1)*sizeof(int));
+
+  if (cech_compute_range(fan, divisor, box, kmin, kmax, result,
+			 stats ? &stats->profile : NULL) < 0)
+    chamber_box_error();
+  if (stats)
+    stats->nrequests++;
+
+  for (i=0; i<=kmax-kmin; i++)
+    printf("%d%s", result[i], (i<kmax-kmin)?" ":"\n");
+
+  free(result);
+}
+
+/* Same as box_cohomology, for every divisor in the grid of the sweep
+   (see cech_sweep), printing one line per point of the grid. */
+static void sweep_cohomology(cech_fan_t *fan, int dim, const int *box,
+			     const int *divisor, int kmin, int kmax,
+			     const cech_direction_t *dirs, int ndirs,
+			     run_stats_t *stats)
+{
+  long npoints = 1, p;
+  int *result;
+  int nh, d, i;
+
+  if (kmin == CECH_ALL_DEGREES) {
+    kmin = 0;
+    kmax = dim;
+  }
+  nh = kmax-kmin+1;
+
+  for (d=0; d<ndirs; d++)
+    npoints *= dirs[d].hi - dirs[d].lo + 1;
+
+  result = malloc(npoints*nh*sizeof(int));
+
+  if (cech_sweep_range(fan, divisor, box, dirs, ndirs, kmin, kmax, result,
+		       stats ? &stats->profile : NULL) < 0)
+    chamber_box_error();
+  if (stats)
+    stats->nrequests += npoints;
+
+  for (p=0; p<npoints; p++) {
+    for (i=0; i<nh; i++)
+      printf("%d%s", result[p*nh+i], (i<nh-1)?" ":"\n");
+  }
+
+  free(result);
+}
+
+/* Parse a direction of a sweep, ray:lo:hi. */
+static void parse_direction(const char *s, cech_direction_t *dir)
+{
+  if (sscanf(s, "%d:%d:%d", &dir->ray, &dir->lo, &dir->hi) != 3 ||
+      dir->ray < 0 || dir->lo > dir->hi)
+    wrong_input(s);
+}
+
+/* Parse k, which is either a non-negative integer, a range kmin..kmax
+   of them, or 'all', in which case kmin is CECH_ALL_DEGREES. */
+static void parse_degrees(const char *s, int *kmin, int *kmax)
+{
+  char *p, *q;
+
+  if (!strncmp(s, "all", 3) && (s[3] == '\0' || strchr(" \t\n", s[3]))) {
+    *kmin = *kmax = CECH_ALL_DEGREES;
+    return;
+  }
+
+  *kmin = *kmax = strtol(s, &p, 10);
+
+  if (p == s || *kmin < 0)
+    wrong_input(s);
+
+  if (!strncmp(p, "..", 2)) {
+    *kmax = strtol(p+2, &q, 10);
+
+    if (q == p+2 || *kmax < *kmin)
+      wrong_input(s);
+  }
+}
+
+/* Read the info for the cohomology to compute from the input
+   file, and compute it. */
+static void scan_box_info(FILE *fd, fan_info_t *info, int kmin, int kmax,
+			  const cech_options_t *opts,
+			  const cech_direction_t *dirs, int ndirs,
+			  run_stats_t *stats)
+{
+  cech_fan_t *fan;
+  int *box;
+  int *divisor;
+  double t[3];
+  int i;
+
+  t[0] = wall_time();
+
+  box = read_box(fd, info->dim);
+
+  /* Got the dimension of the box, read the rays */
+  read_rays(fd, info);
+
+  /* Information for the divisor */
+  divisor = read_divisor(fd, info->nrays);
+
+  /* The cones. */
+  read_cones(fd, info);
+
+  t[1] = wall_time();
+
+  /* We read all the information successfully, compute */
+  fan = make_fan(info, opts);
+
+  t[2] = wall_time();
+
+  if (stats) {
+    stats->parse += t[1] - t[0];
+    stats->setup += t[2] - t[1];
+  }
+
+  for (i=0; i<ndirs; i++) {
+    if (dirs[i].ray >= info->nrays)
+      wrong_input("sweep of a ray which does not exist");
+  }
+
+  if (ndirs > 0)
+    sweep_cohomology(fan, info->dim, box, divisor, kmin, kmax, dirs, ndirs,
+		     stats);
+  else
+    box_cohomology(fan, info->dim, box, divisor, kmin, kmax, stats);
+
+  cech_fan_free(fan);
+  free(divisor);
+  free(box);
+}
+
+/* Batch mode: the input file holds only the fan (the dimension, the
+   rays and the cones), and each request in requests is a line with
+   k, followed by the box and the divisor. One line is printed for
+   each request. */
+static void scan_batch(FILE *fd, fan_info_t *info, FILE *requests,
+		       const cech_options_t *opts, run_stats_t *stats)
+{
+  cech_fan_t *fan;
+  char *line = NULL;
+  size_t nline = 0;
+  double t[3];
+
+  t[0] = wall_time();
+
+  read_rays(fd, info);
+  read_cones(fd, info);
+
+  t[1] = wall_time();
+
+  fan = make_fan(info, opts);
+
+  t[2] = wall_time();
+
+  if (stats) {
+    stats->parse += t[1] - t[0];
+    stats->setup += t[2] - t[1];
+  }
+
+  while (getline(&line, &nline, requests) >= 0) {
+    int *box;
+    int *divisor;
+    int kmin, kmax;
+
+    /* Blank lines between requests are fine. */
+    if (strspn(line, " \t\n") == strlen(line))
+      continue;
+
+    t[0] = wall_time();
+
+    parse_degrees(line + strspn(line, " \t"), &kmin, &kmax);
+
+    box = read_box(requests, info->dim);
+    divisor = read_divisor(requests, info->nrays);
+
+    if (stats)
+      stats->parse += wall_time() - t[0];
+
+    box_cohomology(fan, info->dim, box, divisor, kmin, kmax, stats);
+
+    /* Whoever sent the request may be waiting for the answer. */
+    fflush(stdout);
+
+    free(divisor);
+    free(box);
+  }
+
+  cech_fan_free(fan);
+  free(line);
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *fd, *requests = NULL;
+  char *line = NULL, *p;
+  size_t nline = 0;
+  fan_info_t info;
+  int kmin = 0, kmax = 0;
+  cech_options_t opts;
+  const char *batch = NULL;
+  const char *stats_file = NULL;
+  run_stats_t stats;
+  cech_direction_t dirs[MAX_SWEEP_DIRECTIONS];
+  int ndirs = 0;
+  double start = wall_time();
+  int opt;
+  static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, 's' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  cech_default_options(&opts);
+
+  while ((opt = getopt_long(argc, argv, "b:rt:j:m:B:C:J:SW:", long_options,
+			    NULL)) != -1) {
+    switch (opt) {
+    case 'b':
+      if (!strcmp(optarg, "rank"))
+	opts.cech.backend = BACKEND_RANK;
+      else if (!strcmp(optarg, "chomp"))
+	opts.cech.backend = BACKEND_CHOMP;
+      else if (!strcmp(optarg, "check"))
+	opts.cech.backend = BACKEND_CHECK;
+      else
+	wrong_input(optarg);
+      break;
+    case 'r':
+      opts.cech.reduce = 1;
+      break;
+    case 't':
+      if (!strcmp(optarg, "row"))
+	opts.traversal = TRAVERSE_ROWS;
+      else if (!strcmp(optarg, "point"))
+	opts.traversal = TRAVERSE_POINTS;
+      else if (!strcmp(optarg, "chamber"))
+	opts.traversal = TRAVERSE_CHAMBERS;
+      else
+	wrong_input(optarg);
+      break;
+    case 'j':
+      opts.nthreads = strtol(optarg, &p, 10);
+      if (p == optarg || opts.nthreads < 0)
+	wrong_input(optarg);
+      break;
+    case 'm':
+      opts.budget = strtol(optarg, &p, 10);
+      if (p == optarg || opts.budget < 0)
+	wrong_input(optarg);
+      break;
+    case 'B':
+      batch = optarg;
+      break;
+    case 'C':
+      opts.cache = optarg;
+      break;
+    case 'J':
+      opts.journal = optarg;
+      break;
+    case 'S':
+      opts.symmetries = 0;
+      break;
+    case 'W':
+      if (ndirs == MAX_SWEEP_DIRECTIONS)
+	wrong_input("too many directions to sweep");
+      parse_direction(optarg, &dirs[ndirs++]);
+      break;
+    case 's':
+      stats_file = optarg ? optarg : "-";
+      break;
+    default:
+      /* getopt already complained, show the usage below. */
+      argc = -1;
+      break;
+    }
+  }
+
+  if (argc - optind != (batch ? 1 : 2) || (batch && ndirs > 0)) {
+    printf("Usage: %s [-b backend] [-r] [-t traversal] [-j threads] "
+	   "[-m MB] [-C cache] [-J journal] [-S] [--stats[=file]] "
+	   "[-W ray:lo:hi]... box_info k\n", argv[0]);
+    printf("       %s [options] -B requests fan_info\n", argv[0]);
+    printf("\twhere box_info is the path to a file holding the information\n");
+    printf("\tabout the box and the divisors, and k tells the program to\n");
+    printf("\tcompute the chain complex relevant for H^k. If k is\n");
+    printf("\tkmin..kmax, all of H^kmin, ..., H^kmax are computed, and\n");
+    printf("\tprinted in order in a single line, sharing the parts of the\n");
+    printf("\tCech complexes they need; 'all' stands for 0..dim. A box\n");
+    printf("\tgiven as a line with 'auto' is computed from the rays and\n");
+    printf("\tthe divisor.\n");
+    printf("\n");
+    printf("\t-b backend  how to compute the cohomology of each Cech\n");
+    printf("\t            complex: 'rank' (default) uses exact sparse\n");
+    printf("\t            elimination, 'chomp' runs homchain, and 'check'\n");
+    printf("\t            does both and aborts if they disagree.\n");
+    printf("\t-r          shrink each Cech complex by elementary\n");
+    printf("\t            collapses before computing its cohomology,\n");
+    printf("\t            and report the sizes before and after.\n");
+    printf("\t-t traversal  how to find the sign patterns: 'chamber'\n");
+    printf("\t            enumerates the compact regions of the\n");
+    printf("\t            hyperplane arrangement directly, and only\n");
+    printf("\t            counts their points; it needs the box to be\n");
+    printf("\t            'auto'. 'row' scans the box counting whole\n");
+    printf("\t            intervals of the innermost coordinate at once,\n");
+    printf("\t            and 'point' visits every point in the box. The\n");
+    printf("\t            default is 'row' when the box is given, and\n");
+    printf("\t            'chamber' when it is 'auto'.\n");
+    printf("\t-j threads  number of threads to use, both for traversing\n");
+    printf("\t            the box and for computing the cohomology of the\n");
+    printf("\t            regions found, 0 for one per processor\n");
+    printf("\t            (default 1).\n");
+    printf("\t-m MB       memory budget for the Cech complexes, shared\n");
+    printf("\t            between the threads. The program aborts if a\n");
+    printf("\t            complex does not fit (default no limit).\n");
+    printf("\t-C cache    file keeping the cohomology of the regions\n");
+    printf("\t            computed, which is reused by later runs on\n");
+    printf("\t            the same fan. Several processes may share it.\n");
+    printf("\t-J journal  file keeping the regions found and the\n");
+    printf("\t            cohomology of each region computed, synced to\n");
+    printf("\t            disk as it goes. Running the same computation\n");
+    printf("\t            again with the same journal resumes it where\n");
+    printf("\t            it was left, skipping the traversal.\n");
+    printf("\t-S          compute every region, instead of a single\n");
+    printf("\t            region in each orbit of the permutations of\n");
+    printf("\t            the rays preserving the cones.\n");
+    printf("\t--stats[=file]  write where the time went, the sizes of\n");
+    printf("\t            the Cech complexes and the slowest regions as\n");
+    printf("\t            JSON to file, or to the standard error.\n");
+    printf("\t-W ray:lo:hi  sweep: compute the cohomology for the\n");
+    printf("\t            divisor with lo, ..., hi added to the\n");
+    printf("\t            coefficient of the ray, printing a line for\n");
+    printf("\t            each. With several -W, for every point of the\n");
+    printf("\t            grid, the last direction running fastest.\n");
+    printf("\t            Each region is only computed once, and the\n");
+    printf("\t            box is only traversed once, then updated as\n");
+    printf("\t            the divisor moves. With 'auto', the box holds\n");
+    printf("\t            the compact regions of the whole grid. The\n");
+    printf("\t            chambers cannot be updated as the divisor\n");
+    printf("\t            moves, so with '-t chamber' (or 'auto' and no\n");
+    printf("\t            -t) that box is traversed by rows. Cannot be\n");
+    printf("\t            used with -J.\n");
+    printf("\t-B requests  batch mode. fan_info is like box_info without\n");
+    printf("\t            the box and the divisor, and requests ('-' for\n");
+    printf("\t            the standard input) holds any number of\n");
+    printf("\t            requests, each one a line with k followed by\n");
+    printf("\t            the box and the divisor, in the same format as\n");
+    printf("\t            in box_info. A line with the result is printed\n");
+    printf("\t            for each request.\n");
+    return -1;
+  }
+
+  /* The journal keys a computation by its divisor, which a sweep keeps
+     changing. */
+  if (ndirs > 0 && opts.journal) {
+    printf("ERROR: -J cannot be used with -W.\n");
+    return -1;
+  }
+
+  fd = fopen(argv[optind], "r");
+  if (fd == NULL) {
+    perror("fopen");
+    printf("ERROR: could not open input file '%s'.\n", argv[optind]);
+    return -1;
+  }
+
+  if (batch) {
+    requests = strcmp(batch, "-") ? fopen(batch, "r") : stdin;
+    if (requests == NULL) {
+      perror("fopen");
+      printf("ERROR: could not open requests file '%s'.\n", batch);
+      return -1;
+    }
+  } else
+    parse_degrees(argv[optind+1], &kmin, &kmax);
+
+  if (stats_file) {
+    memset(&stats, 0, sizeof(stats));
+    cech_profile_init(&stats.profile);
+
+    stats.out = strcmp(stats_file, "-") ? fopen(stats_file, "w") : stderr;
+    if (stats.out == NULL) {
+      perror("fopen");
+      printf("ERROR: could not open stats file '%s'.\n", stats_file);
+      return -1;
+    }
+  }
+
+  if (getline(&line, &nline, fd) < 0)
+    wrong_input(line);
+
+  memset(&info, 0, sizeof(info));
+
+  if (sscanf(line, "%d", &info.dim) != 1 || info.dim <= 0)
+    wrong_input(line);
+
+  if (batch)
+    scan_batch(fd, &info, requests, &opts, stats_file ? &stats : NULL);
+  else
+    scan_box_info(fd, &info, kmin, kmax, &opts, dirs, ndirs,
+		  stats_file ? &stats : NULL);
+
+  if (stats_file) {
+    write_stats(&stats, wall_time() - start);
+    cech_profile_free(&stats.profile);
+    if (stats.out != stderr)
+      fclose(stats.out);
+  }
+
+  free_fan_info(&info);
+
+  free(line);
+
+  fclose(fd);
+  if (requests && requests != stdin)
+    fclose(requests);
+
+  return 0;
+}
@@ -0,0 +1,222 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "morse.h"
+
+/* The columns of a differential, in compressed column form. */
+typedef struct {
+  int *col_start;
+  int *rows;
+} transpose_t;
+
+static void transpose(const sparse_matrix_t *m, transpose_t *t,
+		      arena_t *arena)
+{
+  const int nnz = m->row_start[m->nrows];
+  int *fill = arena_alloc(arena, (m->ncols+1)*sizeof(int));
+  int i, j;
+
+  t->col_start = arena_alloc(arena, (m->ncols+1)*sizeof(int));
+  t->rows = arena_alloc(arena, (nnz+1)*sizeof(int));
+
+  memset(t->col_start, 0, (m->ncols+1)*sizeof(int));
+  for (j=0; j<nnz; j++)
+    t->col_start[m->cols[j]+1]++;
+  for (i=0; i<m->ncols; i++)
+    t->col_start[i+1] += t->col_start[i];
+
+  memcpy(fill, t->col_start, (m->ncols+1)*sizeof(int));
+  for (i=0; i<m->nrows; i++) {
+    for (j=m->row_start[i]; j<m->row_start[i+1]; j++)
+      t->rows[fill[m->cols[j]]++] = i;
+  }
+}
+
+/* The value of the entry (row, col), or 0. */
+static int entry(const sparse_matrix_t *m, int row, int col)
+{
+  int j;
+
+  for (j=m->row_start[row]; j<m->row_start[row+1]; j++) {
+    if (m->cols[j] == col)
+      return m->vals[j];
+  }
+
+  return 0;
+}
+
+/* State of the reduction. Layer i is C^i, for 0 <= i <= nd. */
+typedef struct {
+  sparse_matrix_t *d;
+  int nd;
+
+  transpose_t *t; /* Columns of each differential */
+  char **alive; /* alive[i][a] is 0 once a in C^i is removed */
+  int **count; /* count[i][b]: live rows of d[i] with an entry in b */
+
+  /* Columns that may be collapsible, as (differential, column). */
+  int *queue;
+  int nqueue;
+  int queue_size;
+
+  arena_t *arena;
+} reduction_t;
+
+static void push(reduction_t *r, int i, int b)
+{
+  if (r->nqueue + 2 > r->queue_size) {
+    int size = r->queue_size ? 2*r->queue_size : 256;
+
+    r->queue = arena_grow(r->arena, r->queue, r->queue_size*sizeof(int),
+			  size*sizeof(int));
+    r->queue_size = size;
+  }
+
+  r->queue[r->nqueue++] = i;
+  r->queue[r->nqueue++] = b;
+}
+
+/* Remove the element a of C^i. Its row in d[i] no longer counts for
+   the columns it hits, and its column in d[i-1] just disappears. */
+static void remove_element(reduction_t *r, int i, int a)
+{
+  r->alive[i][a] = 0;
+
+  if (i < r->nd) {
+    const sparse_matrix_t *m = &r->d[i];
+    int j;
+
+    for (j=m->row_start[a]; j<m->row_start[a+1]; j++) {
+      int b = m->cols[j];
+
+      if (r->alive[i+1][b] && --r->count[i][b] == 1)
+	push(r, i, b);
+    }
+  }
+}
+
+/* Copy the live part of the differential, renumbering rows and
+   columns. */
+static void compact(sparse_matrix_t *m, const char *alive_rows,
+		    const char *alive_cols, arena_t *arena)
+{
+  sparse_matrix_t out;
+  int *newcol = arena_alloc(arena, (m->ncols+1)*sizeof(int));
+  int nnz = 0;
+  int i, j;
+
+  out.ncols = 0;
+  for (i=0; i<m->ncols; i++)
+    newcol[i] = alive_cols[i] ? out.ncols++ : -1;
+
+  out.nrows = 0;
+  for (i=0; i<m->nrows; i++) {
+    if (!alive_rows[i])
+      continue;
+    out.nrows++;
+    for (j=m->row_start[i]; j<m->row_start[i+1]; j++)
+      nnz += alive_cols[m->cols[j]];
+  }
+
+  out.row_start = arena_alloc(arena, (out.nrows+1)*sizeof(int));
+  out.cols = arena_alloc(arena, (nnz+1)*sizeof(int));
+  out.vals = arena_alloc(arena, (nnz+1)*sizeof(int));
+
+  out.nrows = 0;
+  nnz = 0;
+  for (i=0; i<m->nrows; i++) {
+    if (!alive_rows[i])
+      continue;
+
+    out.row_start[out.nrows++] = nnz;
+    for (j=m->row_start[i]; j<m->row_start[i+1]; j++) {
+      if (alive_cols[m->cols[j]]) {
+	out.cols[nnz] = newcol[m->cols[j]];
+	out.vals[nnz++] = m->vals[j];
+      }
+    }
+  }
+  out.row_start[out.nrows] = nnz;
+
+  *m = out;
+}
+
+int morse_reduce(sparse_matrix_t *d, int nd, arena_t *arena)
+{
+  reduction_t r = {
+    .d = d,
+    .nd = nd,
+    .arena = arena
+  };
+  int npairs = 0;
+  int i, b;
+
+  r.t = arena_alloc(arena, nd*sizeof(transpose_t));
+  r.count = arena_alloc(arena, nd*sizeof(int*));
+  r.alive = arena_alloc(arena, (nd+1)*sizeof(char*));
+
+  for (i=0; i<=nd; i++) {
+    int n = (i < nd) ? d[i].nrows : d[nd-1].ncols;
+
+    r.alive[i] = arena_alloc(arena, n+1);
+    memset(r.alive[i], 1, n);
+  }
+
+  for (i=0; i<nd; i++) {
+    transpose(&d[i], &r.t[i], arena);
+
+    r.count[i] = arena_alloc(arena, (d[i].ncols+1)*sizeof(int));
+    for (b=0; b<d[i].ncols; b++) {
+      r.count[i][b] = r.t[i].col_start[b+1] - r.t[i].col_start[b];
+      if (r.count[i][b] == 1)
+	push(&r, i, b);
+    }
+  }
+
+  while (r.nqueue > 0) {
+    int a = -1, v, j;
+
+    b = r.queue[--r.nqueue];
+    i = r.queue[--r.nqueue];
+
+    if (!r.alive[i+1][b] || r.count[i][b] != 1)
+      continue;
+
+    /* The only live row hitting b. */
+    for (j=r.t[i].col_start[b]; j<r.t[i].col_start[b+1]; j++) {
+      if (r.alive[i][r.t[i].rows[j]]) {
+	a = r.t[i].rows[j];
+	break;
+      }
+    }
+
+    v = entry(&d[i], a, b);
+    if (v != 1 && v != -1)
+      continue;
+
+    remove_element(&r, i, a);
+    remove_element(&r, i+1, b);
+    npairs++;
+  }
+
+  for (i=0; i<nd; i++)
+    compact(&d[i], r.alive[i], r.alive[i+1], arena);
+
+  return npairs;
+}
@@ -0,0 +1,20 @@
+#ifndef __MORSE_H__
+#define __MORSE_H__
+
+#include "sparse.h"
+#include "arena.h"
+
+/* Shrink the cochain complex C^0 -> C^1 -> ... -> C^nd, with
+   differentials d[i] from C^i to C^{i+1} (one row for each element of
+   C^i, one column for each element of C^{i+1}), without changing its
+   cohomology. This removes pairs a in C^i, b in C^{i+1} such that b
+   appears only in the row of a, and with coefficient +1 or -1
+   (elementary collapses, the simplest case of algebraic Morse
+   matchings). Such pairs can be removed without touching the rest of
+   the differentials, so there is no fill-in, and removing them
+   usually frees new ones. The matrices are replaced by the ones of
+   the reduced complex, allocated from the arena. Returns the number
+   of pairs removed. */
+int morse_reduce(sparse_matrix_t *d, int nd, arena_t *arena);
+
+#endif
@@ -0,0 +1,185 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "bitset.h"
+#include "patterns.h"
+
+/* Initial number of buckets in the hash table, a power of two. */
+#define INITIAL_BUCKETS 64
+
+/* Bucket holding the given mask, or the empty bucket where it should
+   be inserted. */
+static int find_bucket(const pattern_table_t *table, const uint64_t *mask)
+{
+  int b = hash_words(0x9e3779b97f4a7c15ULL, mask, table->nwords) & (table->nbuckets-1);
+
+  while (table->buckets[b] >= 0 &&
+	 !bitset_equal(&table->masks[table->buckets[b]*table->nwords],
+		       mask, table->nwords))
+    b = (b+1) & (table->nbuckets-1);
+
+  return b;
+}
+
+/* Double the number of buckets, rehashing the patterns. */
+static void grow_buckets(pattern_table_t *table)
+{
+  int i;
+
+  free(table->buckets);
+
+  table->nbuckets *= 2;
+  table->buckets = malloc(table->nbuckets*sizeof(int));
+  for (i=0; i<table->nbuckets; i++)
+    table->buckets[i] = -1;
+
+  for (i=0; i<table->npatterns; i++)
+    table->buckets[find_bucket(table, &table->masks[i*table->nwords])] = i;
+}
+
+void pattern_table_init(pattern_table_t *table, int nrays)
+{
+  int i;
+
+  memset(table, 0, sizeof(*table));
+
+  table->nrays = nrays;
+  table->nwords = BITSET_WORDS(nrays);
+
+  table->nbuckets = INITIAL_BUCKETS;
+  table->buckets = malloc(table->nbuckets*sizeof(int));
+  for (i=0; i<table->nbuckets; i++)
+    table->buckets[i] = -1;
+}
+
+void pattern_table_free(pattern_table_t *table)
+{
+  free(table->masks);
+  free(table->npoints);
+  free(table->boundary);
+  free(table->buckets);
+}
+
+int find_pattern(const pattern_table_t *table, const uint64_t *mask)
+{
+  return table->buckets[find_bucket(table, mask)];
+}
+
+int add_pattern(pattern_table_t *table, const uint64_t *mask)
+{
+  int b = find_bucket(table, mask);
+  int i;
+
+  if (table->buckets[b] >= 0)
+    return table->buckets[b];
+
+  if (table->npatterns == table->size) {
+    table->size = table->size ? 2*table->size : 16;
+    table->masks = realloc(table->masks,
+			   table->size*table->nwords*sizeof(uint64_t));
+    table->npoints = realloc(table->npoints, table->size*sizeof(int));
+    table->boundary = realloc(table->boundary, table->size*sizeof(int));
+  }
+
+  i = table->npatterns++;
+
+  memcpy(&table->masks[i*table->nwords], mask,
+	 table->nwords*sizeof(uint64_t));
+  table->npoints[i] = 0;
+  table->boundary[i] = 0;
+
+  table->buckets[b] = i;
+
+  /* Keep the load factor below one half. */
+  if (2*table->npatterns > table->nbuckets)
+    grow_buckets(table);
+
+  return i;
+}
+
+void merge_patterns(pattern_table_t *dst, const pattern_table_t *src)
+{
+  int i;
+
+  for (i=0; i<src->npatterns; i++) {
+    int j = add_pattern(dst, &src->masks[i*src->nwords]);
+
+    dst->npoints[j] += src->npoints[i];
+    dst->boundary[j] += src->boundary[i];
+  }
+
+  dst->visited += src->visited;
+}
+
+/* qsort has no way of passing the table to the comparison function,
+   so we sort an array of indices carrying the table along. */
+typedef struct {
+  const pattern_table_t *table;
+  int index;
+} sort_entry_t;
+
+static int compare_entries(const void *a, const void *b)
+{
+  const sort_entry_t *x = a, *y = b;
+  int nwords = x->table->nwords;
+
+  return bitset_compare(&x->table->masks[x->index*nwords],
+			&y->table->masks[y->index*nwords], nwords);
+}
+
+void sort_patterns(pattern_table_t *table)
+{
+  const int n = table->npatterns, nwords = table->nwords;
+  sort_entry_t *entries = malloc(n*sizeof(sort_entry_t));
+  uint64_t *masks = malloc(table->size*nwords*sizeof(uint64_t));
+  int *npoints = malloc(table->size*sizeof(int));
+  int *boundary = malloc(table->size*sizeof(int));
+  int i;
+
+  for (i=0; i<n; i++) {
+    entries[i].table = table;
+    entries[i].index = i;
+  }
+
+  qsort(entries, n, sizeof(sort_entry_t), compare_entries);
+
+  for (i=0; i<n; i++) {
+    int j = entries[i].index;
+
+    memcpy(&masks[i*nwords], &table->masks[j*nwords],
+	   nwords*sizeof(uint64_t));
+    npoints[i] = table->npoints[j];
+    boundary[i] = table->boundary[j];
+  }
+
+  free(table->masks);
+  free(table->npoints);
+  free(table->boundary);
+  table->masks = masks;
+  table->npoints = npoints;
+  table->boundary = boundary;
+
+  /* The positions changed, rebuild the hash table. */
+  for (i=0; i<table->nbuckets; i++)
+    table->buckets[i] = -1;
+  for (i=0; i<n; i++)
+    table->buckets[find_bucket(table, &masks[i*nwords])] = i;
+
+  free(entries);
+}
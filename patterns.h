@@ -0,0 +1,56 @@
+#ifndef __PATTERNS_H__
+#define __PATTERNS_H__
+
+#include <stdint.h>
+
+/* Table of the sign patterns found while traversing the box. Each
+   pattern is stored as the set of rays on which the monomial is
+   negative, packed as a bitset of nwords words, and the patterns are
+   indexed by an open addressing hash table. */
+typedef struct {
+  int nrays;
+  int nwords; /* Words per pattern */
+
+  int npatterns;
+  int size; /* Allocated number of patterns */
+
+  /* Bitset of negative rays for pattern i, at masks[i*nwords] */
+  uint64_t *masks;
+
+  /* Number of points in the region. */
+  int *npoints;
+
+  /* Number of its points on the boundary of the box, so that the
+     region is compact (as far as the box can tell) iff it is zero. */
+  int *boundary;
+
+  /* Hash table, holding indices into the arrays above, or -1 for
+     empty buckets. The number of buckets is a power of two. */
+  int *buckets;
+  int nbuckets;
+
+  /* Number of lattice points visited while filling the table. */
+  long long visited;
+} pattern_table_t;
+
+void pattern_table_init(pattern_table_t *table, int nrays);
+
+void pattern_table_free(pattern_table_t *table);
+
+/* Find a pattern in the table. Returns -1 if not found. */
+int find_pattern(const pattern_table_t *table, const uint64_t *mask);
+
+/* Find a pattern in the table, adding it (with no points, and not on
+   the boundary) if it was not there yet. Returns its position. */
+int add_pattern(pattern_table_t *table, const uint64_t *mask);
+
+/* Add the patterns in src to dst, summing the number of points (and of
+   boundary points) of the patterns present in both. */
+void merge_patterns(pattern_table_t *dst, const pattern_table_t *src);
+
+/* Sort the patterns in the table by their sets of negative rays. This
+   gives a canonical order, independent of the order in which the
+   patterns were found. */
+void sort_patterns(pattern_table_t *table);
+
+#endif
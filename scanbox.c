@@ -15,32 +15,68 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "cohomology.h"
+#include <pthread.h>
+#include "cech.h"
+#include "bitset.h"
+#include "patterns.h"
+#include "threadpool.h"
+#include "cache.h"
+#include "journal.h"
+#include "signs.h"
+#include "box.h"
+#include "chambers.h"
+#include "symmetry.h"
+#include "timing.h"
+
+/* Largest number of symmetries of the fan used. */
+#define MAX_SYMMETRIES 4096
+
+/* Scratch memory for the Cech complexes of one computation, one arena
+   per thread. Computations running at the same time on the same fan
+   take one each, and give it back when done, so that later
+   computations reuse the memory. */
+typedef struct workspace_t {
+  arena_t *arenas;
+  struct workspace_t *next;
+} workspace_t;
+
+/* Everything we know about the fan, which does not depend on the
+   divisor or the box. It is set up once, and shared between all the
+   computations. */
+struct cech_fan_t {
+  int dim; /* Dimension of the M lattice */
 
-#define wrong_input(buf) do {\
-  fprintf(stderr, "[%s:%d] Wrong input!!\n", __FILE__, __LINE__);\
-  fprintf(stderr, "<<%s>>\n", buf);				 \
-  abort();} while(0)
+  int **rays;
+  int nrays;
 
-static int point_count = 0;
+  cone_t **cones;
+  int ncones;
 
-/* List of sign patterns found */
-struct {
-  int *pattern;
+  cech_options_t opts;
+  int nthreads;
 
-  /* Number of points in the region. */
-  int npoints;
+  /* Results of previous runs on the same fan, or NULL. */
+  cache_t *cache;
 
-  /* Whether it's at the boundary of the cone. */
-  int boundary;
-} *patterns = NULL;
+  /* Progress of the computations, or NULL, and the key of the fan in
+     it, which covers the rays as well as the cones. */
+  journal_t *journal;
+  uint64_t journal_key;
 
-/* Total number of patterns */
-static int npatterns = 0;
+  /* Permutations of the rays preserving the cones, just the identity
+     if they are not used. */
+  symmetries_t symmetries;
+
+  /* The memory budget shared by the arenas of all the workspaces. */
+  arena_budget_t budget;
+
+  /* The workspaces not in use, protected by lock. */
+  workspace_t *workspaces;
+  pthread_mutex_t lock;
+};
 
 static int dot(int *a, int *b, int dim)
 {
@@ -53,115 +89,515 @@ static int dot(int *a, int *b, int dim)
   return result;
 }
 
-/* Returns 0 nonzero iff equal. */
-static int equal(int *a, int *b, int dim)
+/* Nonzero iff m is on the boundary of the box */
+static int m_in_boundary(int **box, int *m, int dim)
 {
-  int j;
+  int i;
 
-  for (j=0; j<dim; j++) {
-    if (a[j] != b[j])
-      return 0;
+  for (i=0; i<dim; i++) {
+    if ((m[i] == box[i][0]) || (m[i] == box[i][1]))
+      return 1;
   }
 
-  return 1;
+  return 0;
 }
 
-/* Find a sign pattern in the list of sign patterns. Returns -1 if
-   not found in the list. */
-static int find_pattern(int *pattern, int nrays)
+/* Add the points in the box with m[0], ..., m[k-1] fixed to the
+   given table of patterns. The points are visited in order with an
+   odometer, keeping <m,v_j> for all the rays at once: stepping m[i]
+   by one adds the i-th column of the rays to them, and wrapping it
+   around from its maximum to its minimum subtracts the column times
+   the width of the box. */
+static void traverse_box(int **box, int dim, int **rays, int nrays,
+			 const int *divisor, int k, int *m,
+			 pattern_table_t *table)
 {
-  int i;
+  const sign_kernels_t *kernels = sign_kernels();
+  const int nwords = BITSET_WORDS(nrays), n = SIGNS_SIZE(nrays);
+  /* The columns of the rays, their multiples to wrap around, -a_j and
+     <m,v_j>, padded with zeros. */
+  int32_t columns[dim*n], wraps[dim*n], bounds[n], dots[n];
+  /* Set of rays where the monomial is negative. */
+  uint64_t negative[nwords];
+  /* Pattern for the previous point analyzed. Since neighboring points
+     will generally have the same pattern this saves some searches in
+     the pattern table. */
+  uint64_t last_pattern[nwords];
+  int last_pattern_index = -1;
+  int i, j;
+
+  memset(columns, 0, sizeof(columns));
+  memset(wraps, 0, sizeof(wraps));
+  memset(bounds, 0, sizeof(bounds));
+  memset(dots, 0, sizeof(dots));
+
+  for (i=k; i<dim; i++)
+    m[i] = box[i][0];
+
+  for (j=0; j<nrays; j++) {
+    bounds[j] = -divisor[j];
+    dots[j] = dot(m, rays[j], dim);
+    for (i=0; i<dim; i++) {
+      columns[i*n+j] = rays[j][i];
+      wraps[i*n+j] = -(box[i][1]-box[i][0])*rays[j][i];
+    }
+  }
+
+  for (;;) {
+    /* We have a point in m, analyze it */
+    table->visited++;
+
+    kernels->negative(dots, bounds, n, negative);
+
+    /* Find this pattern in the table of patterns, adding it if we
+       hadn't encountered it before. */
+    if (last_pattern_index < 0 ||
+	!bitset_equal(negative, last_pattern, nwords)) {
+      last_pattern_index = add_pattern(table, negative);
+
+      memcpy(last_pattern, negative, sizeof(negative));
+    }
 
-  /* We are doing a linear search. If we kept the array sorted we
-     could do a binary search and save some time. */
-  for (i=0; i<npatterns; i++) {
-    if (equal(pattern, patterns[i].pattern, nrays))
-      return i; /* Found a match */
+    table->npoints[last_pattern_index]++;
+    if (m_in_boundary(box, m, dim))
+      table->boundary[last_pattern_index]++;
+
+    /* Next point, the last coordinate running fastest. */
+    for (i=dim-1; i>=k; i--) {
+      if (m[i] < box[i][1]) {
+	m[i]++;
+	kernels->add(dots, &columns[i*n], n);
+	break;
+      }
+      m[i] = box[i][0];
+      kernels->add(dots, &wraps[i*n], n);
+    }
+    if (i < k)
+      break;
   }
+}
 
-  /* No match */
-  return -1;
+/* Largest integer not above a/b, for b != 0. */
+static int floor_div(int a, int b)
+{
+  int q = a/b;
+
+  if ((a%b != 0) && ((a<0) != (b<0)))
+    q--;
+
+  return q;
 }
 
-/* Adds a pattern to the list, returning its position. */
-static int add_pattern(int *pattern, int nrays)
+/* Position in a row where the sign of a ray may change. */
+typedef struct {
+  int t;
+  int ray;
+} breakpoint_t;
+
+static int compare_breakpoints(const void *a, const void *b)
 {
-  /* Found no match, add the pattern to the list of patterns. */
-  patterns = realloc(patterns, (npatterns+1)*sizeof(patterns[0]));
-  patterns[npatterns].pattern = malloc(sizeof(int)*nrays);
-  memcpy(patterns[npatterns].pattern, pattern, sizeof(int)*nrays);
+  const breakpoint_t *x = a, *y = b;
 
-  patterns[npatterns].npoints = 0;
+  return (x->t > y->t) - (x->t < y->t);
+}
 
-  patterns[npatterns].boundary = 0;
+/* Same as traverse_box, but instead of visiting the points in the
+   innermost coordinate one at a time, split each row into the
+   intervals where the sign pattern is constant, and count all their
+   points at once. */
+static void traverse_rows(int **box, int dim, int **rays, int nrays,
+			  const int *divisor, int k, int *m,
+			  pattern_table_t *table)
+{
+  const int nwords = BITSET_WORDS(nrays);
+  const int lo = box[dim-1][0], hi = box[dim-1][1];
+  /* Set of rays where the monomial is negative. */
+  uint64_t negative[nwords];
+  breakpoint_t breakpoints[nrays];
+  int nbreakpoints = 0;
+  int on_boundary = 0;
+  int start, i, j;
+
+  if (k<(dim-1)) {
+    for (i=box[k][0]; i<=box[k][1]; i++) {
+      m[k] = i;
+      traverse_rows(box, dim, rays, nrays, divisor, k+1, m, table);
+    }
+    return;
+  }
+
+  /* With the outer coordinates fixed, the condition <m,v_j> >= -a_j
+     becomes c*t >= b for the last coordinate t. Find the sign at the
+     start of the row, and the points where it flips. */
+  bitset_clear(negative, nwords);
+
+  for (j=0; j<nrays; j++) {
+    int c = rays[j][dim-1];
+    int b = -divisor[j] - dot(m, rays[j], dim-1);
+    int flip;
+
+    if (c == 0) {
+      if (b > 0)
+	bitset_add(negative, j);
+      continue;
+    }
+
+    if (c > 0) {
+      /* Negative below ceil(b/c), positive from there on. */
+      flip = -floor_div(-b, c);
+      if (lo < flip)
+	bitset_add(negative, j);
+    } else {
+      /* Positive up to floor(b/c), negative after it. */
+      flip = floor_div(b, c) + 1;
+      if (lo >= flip)
+	bitset_add(negative, j);
+    }
+
+    if (flip > lo && flip <= hi) {
+      breakpoints[nbreakpoints].t = flip;
+      breakpoints[nbreakpoints++].ray = j;
+    }
+  }
+
+  qsort(breakpoints, nbreakpoints, sizeof(breakpoint_t), compare_breakpoints);
+
+  for (i=0; i<dim-1; i++) {
+    if ((m[i] == box[i][0]) || (m[i] == box[i][1]))
+      on_boundary = 1;
+  }
+
+  /* Sweep the intervals [start, end] in order. */
+  start = lo;
+  i = 0;
+  while (start <= hi) {
+    int end, index;
 
-  npatterns++;
+    end = (i < nbreakpoints) ? breakpoints[i].t-1 : hi;
 
-  return (npatterns-1);
+    index = add_pattern(table, negative);
+
+    table->npoints[index] += end-start+1;
+    if (on_boundary)
+      table->boundary[index] += end-start+1;
+    else
+      table->boundary[index] += (start == lo) + (end == hi) - (lo == hi);
+
+    /* Flip the signs of all the rays changing at the next point. */
+    start = end+1;
+    for (; i < nbreakpoints && breakpoints[i].t == start; i++)
+      bitset_toggle(negative, breakpoints[i].ray);
+  }
+
+  table->visited += hi-lo+1;
 }
 
-/* Nonzero iff m is on the boundary of the box */
-static int m_in_boundary(int **box, int *m, int dim)
+/* What the threads traversing the box need to know. */
+typedef struct {
+  int **box;
+  int dim;
+  int **rays;
+  int nrays;
+  const int *divisor;
+  int pointwise;
+
+  /* Each task traverses the part of the box with the first nfixed
+     coordinates fixed. */
+  int nfixed;
+
+  /* One table of patterns per thread. */
+  pattern_table_t *tables;
+} traversal_t;
+
+static void traverse_task(int task, int worker, void *arg)
 {
+  traversal_t *tr = arg;
+  int m[tr->dim];
   int i;
 
-  for (i=0; i<dim; i++) {
-    if ((m[i] == box[i][0]) || (m[i] == box[i][1]))
-      return 1;
+  /* Decode the fixed coordinates from the task number, the last one
+     running fastest. */
+  for (i=tr->nfixed-1; i>=0; i--) {
+    int width = tr->box[i][1] - tr->box[i][0] + 1;
+
+    m[i] = tr->box[i][0] + task % width;
+    task /= width;
   }
 
-  return 0;
+  if (tr->pointwise)
+    traverse_box(tr->box, tr->dim, tr->rays, tr->nrays, tr->divisor,
+		 tr->nfixed, m, &tr->tables[worker]);
+  else
+    traverse_rows(tr->box, tr->dim, tr->rays, tr->nrays, tr->divisor,
+		  tr->nfixed, m, &tr->tables[worker]);
 }
 
-static void traverse_box(int **box, int dim, int **rays, int nrays,
-			 int *divisor, int k, int *m)
+/* Find the sign patterns in the box, and store them in table. The box
+   is split into slices along the outermost coordinates, which are
+   traversed in parallel by nthreads threads, each filling its own
+   table. The tables are merged and sorted at the end, so the result
+   does not depend on the number of threads. */
+static void traverse(int **box, int dim, int **rays, int nrays,
+		     const int *divisor, int pointwise, int nthreads,
+		     pattern_table_t *table)
 {
+  traversal_t tr = {
+    .box = box,
+    .dim = dim,
+    .rays = rays,
+    .nrays = nrays,
+    .divisor = divisor,
+    .pointwise = pointwise,
+    .nfixed = 0
+  };
+  int ntasks = 1;
   int i;
-  int sign_pattern[nrays];
-  /* Pattern for the previous point analyzed. Since neighboring points
-     will generally have the same pattern this saves some searches in
-     the pattern list. */
-  int last_pattern[nrays];
-  int last_pattern_index = 0xdeadbeef;
 
-  memset(last_pattern, 0, nrays*sizeof(int));
+  /* Fix enough outer coordinates to give every thread a few slices,
+     so that work stealing can balance the load. The innermost
+     coordinate is never fixed, rows are traversed as a whole. */
+  while (tr.nfixed < dim-1 && ntasks < 16*nthreads) {
+    ntasks *= box[tr.nfixed][1] - box[tr.nfixed][0] + 1;
+    tr.nfixed++;
+  }
 
-  for (i=box[k][0]; i<=box[k][1]; i++) {
-    m[k] = i;
+  tr.tables = malloc(nthreads*sizeof(pattern_table_t));
+  for (i=0; i<nthreads; i++)
+    pattern_table_init(&tr.tables[i], nrays);
 
-    if (k<(dim-1)) {
-      traverse_box(box, dim, rays, nrays, divisor, k+1, m);
-    } else {
-      int j;
+  run_tasks(nthreads, ntasks, traverse_task, &tr);
 
-      /* We have a point in m, analyze it */
-      point_count++;
-      
-      for (j=0; j<nrays; j++) {
-	if (dot(m, rays[j], dim) >= -divisor[j]) {
-	  sign_pattern[j] = +1;
-	} else {
-	  sign_pattern[j] = -1;
-	}
-      }
+  /* Merge in thread order. */
+  for (i=0; i<nthreads; i++) {
+    merge_patterns(table, &tr.tables[i]);
+    pattern_table_free(&tr.tables[i]);
+  }
+  free(tr.tables);
+
+  sort_patterns(table);
+}
 
-      /* Find this pattern in the list of patterns. */
-      if (!equal(sign_pattern, last_pattern, nrays)) {
-	last_pattern_index = find_pattern(sign_pattern, nrays);
+/* What the threads computing the cohomology of each pattern need to
+   know. */
+typedef struct {
+  const pattern_table_t *patterns;
+  /* Patterns in the interior, the ones we need to compute. */
+  const int *interior;
+
+  /* The degrees computed. */
+  int kmin, kmax;
+  const cech_fan_t *fan;
+  const cech_config_t *config;
+  arena_t *arenas;
+
+  /* The journal, if any, and the key of the computation in it. */
+  journal_t *journal;
+  uint64_t run;
+
+  /* Cohomology of each interior pattern, nh = kmax-kmin+1 values per
+     pattern. */
+  int *h;
+  int nh;
+
+  /* Sizes of the complexes computed by each thread. */
+  cech_stats_t *stats;
+
+  /* Seconds taken by each interior pattern. */
+  double *times;
+
+  /* Patterns computed, rather than found in the journal or the
+     cache. Only accessed atomically. */
+  int computed;
+} evaluation_t;
+
+/* Look up h^kmin, ..., h^kmax of the region in the cache. All the
+   degrees are kept in a single record (k < 0 in cache_lookup), any
+   other range one degree at a time. */
+static int lookup_cached(const cech_fan_t *fan, int kmin, int kmax,
+			 const uint64_t *negative, int *h)
+{
+  int k;
 
-	/* We hadn't encountered this sign pattern before, add it to
-	   the list. */
-	if (last_pattern_index < 0)
-	  last_pattern_index = add_pattern(sign_pattern, nrays);
+  if (kmin == 0 && kmax == fan->dim)
+    return cache_lookup(fan->cache, -1, negative, h, fan->dim+1);
 
-	memcpy(last_pattern, sign_pattern, sizeof(sign_pattern));
-      }
+  for (k=kmin; k<=kmax; k++) {
+    if (!cache_lookup(fan->cache, k, negative, &h[k-kmin], 1))
+      return 0;
+  }
 
-      patterns[last_pattern_index].npoints++;
-      if (m_in_boundary(box, m, dim))
-	patterns[last_pattern_index].boundary = 1;
-    }
+  return 1;
+}
+
+/* Store h^kmin, ..., h^kmax of the region in the cache, as
+   lookup_cached expects them. */
+static void store_cached(const cech_fan_t *fan, int kmin, int kmax,
+			 const uint64_t *negative, const int *h)
+{
+  int k;
+
+  if (kmin == 0 && kmax == fan->dim) {
+    cache_store(fan->cache, -1, negative, h, fan->dim+1);
+    return;
+  }
+
+  for (k=kmin; k<=kmax; k++)
+    cache_store(fan->cache, k, negative, &h[k-kmin], 1);
+}
+
+static void evaluate_task(int task, int worker, void *arg)
+{
+  evaluation_t *ev = arg;
+  const uint64_t *negative =
+    &ev->patterns->masks[ev->interior[task]*ev->patterns->nwords];
+  const cech_fan_t *fan = ev->fan;
+  int *h = &ev->h[task*ev->nh];
+  double start = wall_time();
+
+  if ((ev->journal &&
+       journal_lookup(ev->journal, ev->run, ev->interior[task], h, ev->nh))
+      || (fan->cache &&
+	  lookup_cached(fan, ev->kmin, ev->kmax, negative, h))) {
+    ev->times[task] = wall_time() - start;
+    return;
   }
+
+  compute_cohomology(ev->kmin, ev->kmax, negative, fan->cones, fan->ncones,
+		     ev->config, &ev->arenas[worker], &ev->stats[worker], h);
+
+  if (fan->cache)
+    store_cached(fan, ev->kmin, ev->kmax, negative, h);
+  if (ev->journal)
+    journal_store(ev->journal, ev->run, ev->interior[task], h, ev->nh);
+
+  __atomic_fetch_add(&ev->computed, 1, __ATOMIC_RELAXED);
+  ev->times[task] = wall_time() - start;
+}
+
+/* Keep the region in the list of slowest regions of the profile, if
+   it is slow enough. */
+static void note_region_time(cech_profile_t *profile,
+			     const pattern_table_t *patterns, int index,
+			     double time)
+{
+  const uint64_t *negative = &patterns->masks[index*patterns->nwords];
+  cech_region_time_t region;
+  int i, j;
+
+  if (profile->nslowest == CECH_SLOWEST &&
+      time <= profile->slowest[CECH_SLOWEST-1].time)
+    return;
+
+  /* Reuse the string of the region dropped, if any. */
+  if (profile->nslowest == CECH_SLOWEST)
+    region.signs = profile->slowest[--profile->nslowest].signs;
+  else
+    region.signs = malloc(patterns->nrays+1);
+
+  region.time = time;
+  region.npoints = patterns->npoints[index];
+  for (j=0; j<patterns->nrays; j++)
+    region.signs[j] = bitset_contains(negative, j) ? '-' : '+';
+  region.signs[patterns->nrays] = '\0';
+
+  for (i=profile->nslowest; i>0 && profile->slowest[i-1].time < time; i--)
+    profile->slowest[i] = profile->slowest[i-1];
+  profile->slowest[i] = region;
+  profile->nslowest++;
+}
+
+/* Compute the cohomology in degrees kmin, ..., kmax of the ninterior
+   patterns of the table at the given positions, and return it,
+   kmax-kmin+1 values per pattern, in an array to be freed by the
+   caller. The regions are computed in parallel. The journal, if not NULL, keeps the results of the computation run.
+   The complexes and the slowest regions are added to the profile, if
+   any. */
+static int *compute_regions(const pattern_table_t *patterns,
+			    const int *interior, int ninterior,
+			    int kmin, int kmax,
+			    const cech_fan_t *fan, journal_t *journal,
+			    uint64_t run, arena_t *arenas,
+			    cech_profile_t *profile)
+{
+  cech_config_t config = fan->opts.cech;
+  evaluation_t ev = {
+    .patterns = patterns,
+    .interior = interior,
+    .kmin = kmin,
+    .kmax = kmax,
+    .fan = fan,
+    .config = &config,
+    .arenas = arenas,
+    .journal = journal,
+    .run = run,
+    .nh = kmax-kmin+1
+  };
+  cech_stats_t total;
+  int i;
+
+  /* The large differentials are split in blocks, one per thread, and
+     the threads which run out of regions help with the blocks of the
+     regions still being computed (see run_tasks_sharing). */
+  config.nthreads = fan->nthreads;
+
+  ev.h = malloc((ninterior > 0 ? ninterior : 1)*ev.nh*sizeof(int));
+  ev.stats = calloc(fan->nthreads, sizeof(cech_stats_t));
+  ev.times = malloc(ninterior*sizeof(double));
+
+  run_tasks_sharing(fan->nthreads, ninterior, evaluate_task, &ev);
+
+  memset(&total, 0, sizeof(total));
+  for (i=0; i<fan->nthreads; i++)
+    add_stats(&total, &ev.stats[i]);
+  free(ev.stats);
+
+  if (config.reduce)
+    fprintf(stderr, "Reduction: %lld cells, %lld entries -> "
+	    "%lld cells, %lld entries\n", total.cells, total.entries,
+	    total.reduced_cells, total.reduced_entries);
+
+  if (profile) {
+    add_stats(&profile->complexes, &total);
+    profile->computed += ev.computed;
+    for (i=0; i<ninterior; i++)
+      note_region_time(profile, patterns, interior[i], ev.times[i]);
+  }
+  free(ev.times);
+
+  return ev.h;
+}
+
+/* Compute the cohomology in degrees kmin, ..., kmax of every compact
+   region in the table, and add them up weighted by their number of
+   points. The results are added in the order of the table, so the
+   result does not depend on the scheduling. */
+static void evaluate_patterns(const pattern_table_t *patterns,
+			      int kmin, int kmax, const cech_fan_t *fan,
+			      uint64_t run, arena_t *arenas, int *result,
+			      cech_profile_t *profile)
+{
+  const int nh = kmax-kmin+1;
+  int *interior, *h;
+  int ninterior = 0;
+  int i, j;
+
+  interior = malloc(patterns->npatterns*sizeof(int));
+  for (i=0; i<patterns->npatterns; i++) {
+    if (!patterns->boundary[i])
+      interior[ninterior++] = i;
+  }
+
+  h = compute_regions(patterns, interior, ninterior, kmin, kmax, fan,
+		      fan->journal, run, arenas, profile);
+
+  memset(result, 0, nh*sizeof(int));
+  for (i=0; i<ninterior; i++) {
+    for (j=0; j<nh; j++)
+      result[j] += h[i*nh+j] * patterns->npoints[interior[i]];
+  }
+
+  free(h);
+  free(interior);
 }
 
 void free_cone(cone_t *cone)
@@ -171,206 +607,721 @@ void free_cone(cone_t *cone)
   free(cone);
 }
 
-/* Read the info for the cohomology to compute from the input
-   file. dim is the dimension of the M lattice, and k the cohomology
-   we are interested in. */
-static void scan_box_info(FILE *fd, int dim, int k)
+void cech_profile_init(cech_profile_t *profile)
+{
+  memset(profile, 0, sizeof(*profile));
+}
+
+void cech_profile_free(cech_profile_t *profile)
 {
-  int **box;
-  char *line = NULL;
-  size_t nline = 0;
   int i;
-  int nrays;
-  int **rays;
-  int m[dim];
-  int *divisor;
-  char *ptr;
-  cone_t **cones;
-  int ncones;
-  int result = 0;
 
-  box = malloc(dim*sizeof(int*));
+  for (i=0; i<profile->nslowest; i++)
+    free(profile->slowest[i].signs);
+  profile->nslowest = 0;
+}
 
-  for (i=0; i<dim; i++) {
-    box[i] = malloc(2*sizeof(int));
+void cech_default_options(cech_options_t *opts)
+{
+  memset(opts, 0, sizeof(*opts));
+
+  opts->cech.backend = BACKEND_RANK;
+  opts->cech.reduce = 0;
+  opts->traversal = TRAVERSE_AUTO;
+  opts->nthreads = 1;
+  opts->budget = 0;
+  opts->cache = NULL;
+  opts->journal = NULL;
+  opts->symmetries = 1;
+}
+
+cech_fan_t *cech_fan_new(int dim, const int *rays, int nrays,
+			 const int *cone_sizes, const int *cone_rays,
+			 int ncones, const cech_options_t *opts)
+{
+  cech_fan_t *fan;
+  const int nwords = BITSET_WORDS(nrays);
+  uint64_t *rays_in_cone[ncones > 0 ? ncones : 1];
+  int i, j, next = 0;
 
-    if (getline(&line, &nline, fd) < 0)
-      wrong_input(line);
+  if (dim <= 0 || nrays <= 0 || ncones <= 0)
+    return NULL;
 
-    if (sscanf(line, "%d %d", &box[i][0], &box[i][1]) != 2)
-      wrong_input(line);
+  for (i=0; i<ncones; i++) {
+    for (j=0; j<cone_sizes[i]; j++) {
+      if (cone_rays[next+j] < 0 || cone_rays[next+j] >= nrays)
+	return NULL;
+    }
+    next += cone_sizes[i];
   }
 
-  /* Got the dimension of the box, read the rays */
-  if (getline(&line, &nline, fd) < 0)
-    wrong_input(line);
+  fan = calloc(1, sizeof(cech_fan_t));
+  fan->dim = dim;
+  fan->opts = *opts;
 
-  if (sscanf(line, "%d\n", &nrays) != 1)
-    wrong_input(line);
+  fan->nrays = nrays;
+  fan->rays = malloc(nrays*sizeof(int*));
+  for (i=0; i<nrays; i++) {
+    fan->rays[i] = malloc(dim*sizeof(int));
+    memcpy(fan->rays[i], &rays[i*dim], dim*sizeof(int));
+  }
 
-  rays = malloc(nrays*sizeof(int*));
+  fan->ncones = ncones;
+  fan->cones = malloc(ncones*sizeof(cone_t*));
+  next = 0;
+  for (i=0; i<ncones; i++) {
+    cone_t *cone = fan->cones[i] = malloc(sizeof(cone_t));
 
-  for (i=0; i<nrays; i++) {
-    int j;
+    /* Top dimensional cones are the intersection with themselves. */
+    cone->id = i;
+    cone->nintersections = 1;
+    cone->intersections = malloc(sizeof(int));
+    cone->intersections[0] = i;
+
+    cone->nwords = nwords;
+    cone->rays = malloc(nwords*sizeof(uint64_t));
+    bitset_clear(cone->rays, nwords);
+    for (j=0; j<cone_sizes[i]; j++)
+      bitset_add(cone->rays, cone_rays[next++]);
+
+    rays_in_cone[i] = cone->rays;
+  }
+
+  find_symmetries(rays_in_cone, ncones, nrays,
+		  opts->symmetries ? MAX_SYMMETRIES : 1, &fan->symmetries);
+
+  fan->nthreads = threads_for(opts->nthreads);
+  arena_budget_init(&fan->budget, (size_t) opts->budget << 20);
+  fan->workspaces = NULL;
+  pthread_mutex_init(&fan->lock, NULL);
+
+  if (opts->cache) {
+    /* The cohomology of the regions only depends on which rays are
+       in which cones. */
+    fan->cache = cache_open(opts->cache,
+			    fan_key(rays_in_cone, ncones, nwords), nwords);
+    if (!fan->cache) {
+      cech_fan_free(fan);
+      return NULL;
+    }
+  }
 
-    rays[i] = malloc(dim*sizeof(int));
+  if (opts->journal) {
+    /* The patterns found depend on the rays themselves too. */
+    fan->journal_key = journal_key(fan_key(rays_in_cone, ncones, nwords),
+				   rays, nrays*dim);
+    fan->journal = journal_open(opts->journal);
+    if (!fan->journal) {
+      cech_fan_free(fan);
+      return NULL;
+    }
+  }
 
-    if (getline(&line, &nline, fd) < 0)
-      wrong_input(line);
+  return fan;
+}
 
-    ptr = line;
+void cech_fan_free(cech_fan_t *fan)
+{
+  int i;
 
-    for (j=0; j<dim; j++) {
-      char *p;
+  while (fan->workspaces) {
+    workspace_t *ws = fan->workspaces;
 
-      rays[i][j] = strtol(ptr, &p, 10);
+    fan->workspaces = ws->next;
+    for (i=0; i<fan->nthreads; i++)
+      arena_free(&ws->arenas[i]);
+    free(ws->arenas);
+    free(ws);
+  }
+  pthread_mutex_destroy(&fan->lock);
 
-      if (ptr == p)
-	wrong_input(line);
+  if (fan->cache)
+    cache_close(fan->cache);
+  if (fan->journal)
+    journal_close(fan->journal);
 
-      ptr = p;
-    }
+  free_symmetries(&fan->symmetries);
+
+  for (i=0; i<fan->ncones; i++)
+    free_cone(fan->cones[i]);
+  free(fan->cones);
+
+  for (i=0; i<fan->nrays; i++)
+    free(fan->rays[i]);
+  free(fan->rays);
+
+  free(fan);
+}
+
+/* Take a workspace not in use, or make a new one. */
+static workspace_t *take_workspace(cech_fan_t *fan)
+{
+  workspace_t *ws;
+  int i;
+
+  pthread_mutex_lock(&fan->lock);
+  ws = fan->workspaces;
+  if (ws)
+    fan->workspaces = ws->next;
+  pthread_mutex_unlock(&fan->lock);
+
+  if (ws)
+    return ws;
+
+  ws = malloc(sizeof(workspace_t));
+  ws->arenas = malloc(fan->nthreads*sizeof(arena_t));
+  for (i=0; i<fan->nthreads; i++)
+    arena_init(&ws->arenas[i], fan->opts.budget ? &fan->budget : NULL);
+
+  return ws;
+}
+
+static void give_back_workspace(cech_fan_t *fan, workspace_t *ws)
+{
+  pthread_mutex_lock(&fan->lock);
+  ws->next = fan->workspaces;
+  fan->workspaces = ws;
+  pthread_mutex_unlock(&fan->lock);
+}
+
+/* Replace the compact regions in the table by one region for each of
+   their orbits under the symmetries of the fan, holding all of their
+   points. The regions on the boundary are dropped. */
+static void merge_orbits(const symmetries_t *sym, pattern_table_t *table)
+{
+  pattern_table_t orbits;
+  uint64_t canonical[table->nwords];
+  int i;
+
+  pattern_table_init(&orbits, table->nrays);
+
+  for (i=0; i<table->npatterns; i++) {
+    int j;
+
+    if (table->boundary[i])
+      continue;
+
+    canonical_pattern(sym, &table->masks[i*table->nwords], canonical);
+
+    j = add_pattern(&orbits, canonical);
+    orbits.npoints[j] += table->npoints[i];
   }
 
-  /* Information for the divisor */
-  divisor = malloc(nrays*sizeof(int));
+  orbits.visited = table->visited;
+  sort_patterns(&orbits);
 
-  if (getline(&line, &nline, fd) < 0)
-    wrong_input(line);
+  pattern_table_free(table);
+  *table = orbits;
+}
 
-  ptr = line;
+/* The traversal to use with the given box (NULL if it is to be
+   computed), or -1 if the chambers were asked for with an explicit
+   box, which they would silently ignore. */
+static int resolve_traversal(const cech_fan_t *fan, const int *box)
+{
+  if (fan->opts.traversal == TRAVERSE_AUTO)
+    return box ? TRAVERSE_ROWS : TRAVERSE_CHAMBERS;
 
-  for (i=0; i<nrays; i++) {
-    char *p;
+  if (fan->opts.traversal == TRAVERSE_CHAMBERS && box)
+    return -1;
+
+  return fan->opts.traversal;
+}
 
-    divisor[i] = strtol(ptr, &p, 10);
-    
-    if (ptr == p)
-      wrong_input(line);
-    
-    ptr = p;
+/* Drop the regions of the table which do not reach the boundary of
+   the box, but are not compact either (see compact_box), along with
+   those which do: all their points are counted as boundary points. */
+static void drop_unbounded(const cech_fan_t *fan, pattern_table_t *table)
+{
+  int i;
+
+  for (i=0; i<table->npatterns; i++) {
+    if (!table->boundary[i] &&
+	!region_bounded(fan->rays, fan->nrays, fan->dim,
+			&table->masks[i*table->nwords]))
+      table->boundary[i] = table->npoints[i];
   }
+}
 
-  /* The cones. */
-  if (getline(&line, &nline, fd) < 0)
-    wrong_input(line);
+/* The range of degrees of cech_compute and cech_sweep. Returns -1 if k
+   is out of range. */
+static int degree_range(const cech_fan_t *fan, int k, int *kmin, int *kmax)
+{
+  if (k < 0 && k != CECH_ALL_DEGREES)
+    return -1;
 
-  if (sscanf(line, "%d\n", &ncones) != 1)
-    wrong_input(line);
+  *kmin = (k == CECH_ALL_DEGREES) ? 0 : k;
+  *kmax = (k == CECH_ALL_DEGREES) ? fan->dim : k;
 
-  cones = malloc(ncones*sizeof(cone_t*));
+  return 0;
+}
 
-  for (i=0; i<ncones; i++) {
-    int j;
+int cech_compute(cech_fan_t *fan, const int *divisor, const int *box, int k,
+		 int *h, cech_profile_t *profile)
+{
+  int kmin, kmax;
 
-    cones[i] = malloc(sizeof(cone_t));
+  if (degree_range(fan, k, &kmin, &kmax) < 0)
+    return -1;
 
-    if (getline(&line, &nline, fd) < 0)
-      wrong_input(line);
+  return cech_compute_range(fan, divisor, box, kmin, kmax, h, profile);
+}
 
-    if (sscanf(line, "%d\n", &cones[i]->nrays) != 1)
-      wrong_input(line);
+int cech_compute_range(cech_fan_t *fan, const int *divisor, const int *box,
+		       int kmin, int kmax, int *h, cech_profile_t *profile)
+{
+  const int dim = fan->dim;
+  pattern_table_t patterns;
+  workspace_t *ws;
+  int *box_rows[dim];
+  int box_data[2*dim];
+  const int traversal = resolve_traversal(fan, box);
+  uint64_t run = 0;
+  int resumed = 0;
+  double t[5];
+  int i;
 
-    /* Top dimensional cones are the intersection with themselves. */
-    cones[i]->id = i;
-    cones[i]->nintersections = 1;
-    cones[i]->intersections = malloc(sizeof(int));
-    cones[i]->intersections[0] = i;
+  if (kmin < 0 || kmax < kmin || traversal < 0)
+    return -1;
 
-    cones[i]->rays = malloc(cones[i]->nrays*sizeof(int));
+  t[0] = wall_time();
 
-    if (getline(&line, &nline, fd) < 0)
-      wrong_input(line);
+  /* The traversals take the box as an array of rows. */
+  if (box)
+    memcpy(box_data, box, sizeof(box_data));
+  for (i=0; i<dim; i++)
+    box_rows[i] = &box_data[2*i];
+  if (!box && traversal != TRAVERSE_CHAMBERS)
+    compact_box(fan->rays, fan->nrays, dim, divisor, box_rows);
+
+  t[1] = wall_time();
+
+  pattern_table_init(&patterns, fan->nrays);
+
+  if (fan->journal) {
+    /* Everything the patterns and their cohomology depend on. */
+    const int params[4] = {
+      kmin, kmax, traversal, fan->symmetries.nperms
+    };
 
-    ptr = line;
+    run = journal_key(fan->journal_key, divisor, fan->nrays);
+    if (traversal != TRAVERSE_CHAMBERS)
+      run = journal_key(run, box_data, 2*dim);
+    run = journal_key(run, params, 4);
 
-    for (j=0; j<cones[i]->nrays; j++) {
-      char *p;
+    resumed = journal_load_patterns(fan->journal, run, &patterns);
+  }
 
-      cones[i]->rays[j] = strtol(ptr, &p, 10);
+  if (!resumed) {
+    if (traversal == TRAVERSE_CHAMBERS)
+      find_chambers(fan->rays, fan->nrays, dim, divisor, fan->nthreads,
+		    &patterns);
+    else {
+      traverse(box_rows, dim, fan->rays, fan->nrays, divisor,
+	       traversal == TRAVERSE_POINTS, fan->nthreads,
+	       &patterns);
+      drop_unbounded(fan, &patterns);
+    }
+  }
 
-      if (ptr == p)
-	wrong_input(line);
+  t[2] = wall_time();
 
-      ptr = p;
+  if (profile) {
+    profile->visited += patterns.visited;
+    for (i=0; i<patterns.npatterns; i++) {
+      if (patterns.boundary[i])
+	profile->boundary++;
+      else
+	profile->interior++;
     }
   }
 
-  /* We read all the information successfully, traverse the box */
-  traverse_box(box, dim, rays, nrays, divisor, 0, m);
+  /* The journal keeps the patterns left after merging the orbits, so
+     a resumed computation goes straight to their cohomology. */
+  if (!resumed) {
+    if (fan->symmetries.nperms > 1)
+      merge_orbits(&fan->symmetries, &patterns);
+
+    if (fan->journal)
+      journal_store_patterns(fan->journal, run, &patterns);
+  }
+
+  t[3] = wall_time();
 
   /* Compute the cohomology for each compact region. */
-  for (i=0; i<npatterns; i++) {
-    if (!patterns[i].boundary) {
-      result += compute_kth_cohomology(k, patterns[i].pattern, cones, ncones) * patterns[i].npoints;
+  ws = take_workspace(fan);
+  evaluate_patterns(&patterns, kmin, kmax, fan, run, ws->arenas, h,
+		    profile);
+  give_back_workspace(fan, ws);
+
+  t[4] = wall_time();
+
+  if (profile) {
+    profile->box += t[1] - t[0];
+    profile->traversal += t[2] - t[1];
+    profile->orbits += t[3] - t[2];
+    profile->cohomology += t[4] - t[3];
+  }
+
+  pattern_table_free(&patterns);
+
+  return 0;
+}
+
+/* Move the coefficient of the given ray in the divisor by step (1 or
+   -1), updating the table of patterns of the points in the box. Only
+   the points on the hyperplane where the sign for the ray flips change
+   their pattern, so only those are visited: the hyperplane is solved
+   for the coordinate with the widest range in the box, and the other
+   coordinates run over the box. */
+static void move_hyperplane(int **box, int dim, int **rays, int nrays,
+			    int *divisor, int ray, int step,
+			    pattern_table_t *table)
+{
+  const int nwords = BITSET_WORDS(nrays);
+  int *v = rays[ray];
+  /* Negative means <m,v> < -a, so the points flipping are those with
+     <m,v> = -a-1 if a grows, and <m,v> = -a if it shrinks. */
+  const int c = (step > 0) ? -divisor[ray]-1 : -divisor[ray];
+  uint64_t negative[nwords];
+  int m[dim];
+  int p = -1, q, j;
+
+  divisor[ray] += step;
+
+  for (q=0; q<dim; q++) {
+    if (v[q] != 0 && (p < 0 ||
+		      box[q][1]-box[q][0] > box[p][1]-box[p][0]))
+      p = q;
+    m[q] = box[q][0];
+  }
+
+  if (p < 0)
+    return;
+
+  for (;;) {
+    int rest = c, index, on_boundary;
+
+    for (q=0; q<dim; q++) {
+      if (q != p)
+	rest -= v[q]*m[q];
     }
+
+    if (rest % v[p] == 0 && rest/v[p] >= box[p][0] &&
+	rest/v[p] <= box[p][1]) {
+      m[p] = rest/v[p];
+      table->visited++;
+
+      bitset_clear(negative, nwords);
+      for (j=0; j<nrays; j++) {
+	if (dot(m, rays[j], dim) < -divisor[j])
+	  bitset_add(negative, j);
+      }
+
+      on_boundary = m_in_boundary(box, m, dim);
+
+      index = add_pattern(table, negative);
+      table->npoints[index]++;
+      table->boundary[index] += on_boundary;
+
+      /* The point had the same pattern, but with the opposite sign for
+	 the ray moved. The region it leaves stops touching the boundary
+	 when its last boundary point is gone. */
+      bitset_toggle(negative, ray);
+      index = find_pattern(table, negative);
+      if (index < 0) {
+	fprintf(stderr, "ERROR: a point in the box had no pattern.\n");
+	abort();
+      }
+      table->npoints[index]--;
+      table->boundary[index] -= on_boundary;
+    }
+
+    /* Next point, running over all the coordinates but p. */
+    for (q=dim-1; q>=0; q--) {
+      if (q == p)
+	continue;
+      if (m[q] < box[q][1]) {
+	m[q]++;
+	break;
+      }
+      m[q] = box[q][0];
+    }
+    if (q < 0)
+      break;
   }
+}
 
-  for (i=0; i<ncones; i++) {
-    free_cone(cones[i]);
+/* The cohomology of the regions computed so far in a sweep, keyed by
+   their (canonical) sets of negative rays. */
+typedef struct {
+  pattern_table_t seen;
+  int *h; /* nh values for each pattern in seen */
+  int nh;
+
+  /* Whether the pattern at each position of the table of the sweep is
+     compact (see region_bounded), or -1 if not known yet. */
+  signed char *compact;
+  int ncompact;
+} sweep_memo_t;
+
+/* Whether the pattern at the given position of the table is compact,
+   remembering it in the memo. */
+static int pattern_compact(const pattern_table_t *table, int i,
+			   const cech_fan_t *fan, sweep_memo_t *memo)
+{
+  if (i >= memo->ncompact) {
+    memo->compact = realloc(memo->compact, table->npatterns);
+    memset(&memo->compact[memo->ncompact], -1,
+	   table->npatterns - memo->ncompact);
+    memo->ncompact = table->npatterns;
   }
-  free(cones);
 
-  free(divisor);
+  if (memo->compact[i] < 0)
+    memo->compact[i] = region_bounded(fan->rays, fan->nrays, fan->dim,
+				      &table->masks[i*table->nwords]);
 
-  for (i=0; i<nrays; i++)
-    free(rays[i]);
-  free(rays);
+  return memo->compact[i];
+}
 
-  for (i=0; i<dim; i++)
-    free(box[i]);
-  free(box);
+/* Compute the cohomology of the line bundle whose sign patterns are in
+   the table, computing only the regions not in the memo, and adding
+   them to it. */
+static void sweep_point(const pattern_table_t *table, int kmin, int kmax,
+			const cech_fan_t *fan, sweep_memo_t *memo,
+			arena_t *arenas, int *result, cech_profile_t *profile)
+{
+  const int nwords = table->nwords, nh = memo->nh;
+  pattern_table_t orbits, todo;
+  uint64_t canonical[nwords];
+  int *positions, *h;
+  double t[3];
+  int i, j, l;
+
+  t[0] = wall_time();
+
+  /* The regions of the line bundle, merged by orbits. Patterns left
+     with no points by the moves of the hyperplanes are skipped, and
+     so are the ones which are not compact, whether they reach the
+     boundary of the box or not. */
+  pattern_table_init(&orbits, table->nrays);
+  for (i=0; i<table->npatterns; i++) {
+    int compact;
+
+    if (table->npoints[i] == 0)
+      continue;
+
+    compact = !table->boundary[i] && pattern_compact(table, i, fan, memo);
+
+    if (profile) {
+      if (compact)
+	profile->interior++;
+      else
+	profile->boundary++;
+    }
 
-  for (i=0; i<npatterns; i++) {
-    free(patterns[i].pattern);
+    if (!compact)
+      continue;
+
+    canonical_pattern(&fan->symmetries, &table->masks[i*nwords], canonical);
+    j = add_pattern(&orbits, canonical);
+    orbits.npoints[j] += table->npoints[i];
+  }
+
+  pattern_table_init(&todo, table->nrays);
+  for (i=0; i<orbits.npatterns; i++) {
+    if (find_pattern(&memo->seen, &orbits.masks[i*nwords]) < 0)
+      add_pattern(&todo, &orbits.masks[i*nwords]);
+  }
+
+  t[1] = wall_time();
+
+  positions = malloc((todo.npatterns > 0 ? todo.npatterns : 1)*sizeof(int));
+  for (i=0; i<todo.npatterns; i++)
+    positions[i] = i;
+
+  h = compute_regions(&todo, positions, todo.npatterns, kmin, kmax, fan,
+		      NULL, 0, arenas, profile);
+
+  for (i=0; i<todo.npatterns; i++)
+    add_pattern(&memo->seen, &todo.masks[i*nwords]);
+  memo->h = realloc(memo->h, memo->seen.npatterns*nh*sizeof(int));
+  memcpy(&memo->h[(memo->seen.npatterns - todo.npatterns)*nh], h,
+	 todo.npatterns*nh*sizeof(int));
+
+  memset(result, 0, nh*sizeof(int));
+  for (i=0; i<orbits.npatterns; i++) {
+    j = find_pattern(&memo->seen, &orbits.masks[i*nwords]);
+    for (l=0; l<nh; l++)
+      result[l] += memo->h[j*nh+l] * orbits.npoints[i];
   }
-  free(patterns);
 
-  free(line);
+  t[2] = wall_time();
 
-  /* Done, print the result. */
-  printf("%d\n", result);
+  if (profile) {
+    profile->orbits += t[1] - t[0];
+    profile->cohomology += t[2] - t[1];
+  }
+
+  free(h);
+  free(positions);
+  pattern_table_free(&todo);
+  pattern_table_free(&orbits);
 }
 
-int main(int argc, char *argv[])
+long cech_sweep(cech_fan_t *fan, const int *divisor, const int *box,
+		const cech_direction_t *dirs, int ndirs, int k, int *h,
+		cech_profile_t *profile)
 {
-  FILE *fd;
-  char *line = NULL, *p;
-  size_t nline = 0;
-  int dim; /* Dimension of the M lattice */
-  int k;
+  int kmin, kmax;
 
-  if (argc != 3) {
-    printf("Usage: %s box_info k\n", argv[0]);
-    printf("\twhere box_info is the path to a file holding the information\n");
-    printf("\tabout the box and the divisors, and k tells the program to\n");
-    printf("\tcompute the chain complex relevant for H^k.\n");
+  if (degree_range(fan, k, &kmin, &kmax) < 0)
     return -1;
-  }
 
-  fd = fopen(argv[1], "r");
-  if (fd == NULL) {
-    perror("fopen");
-    printf("ERROR: could not open input file '%s'.\n", argv[1]);
+  return cech_sweep_range(fan, divisor, box, dirs, ndirs, kmin, kmax, h,
+			  profile);
+}
+
+long cech_sweep_range(cech_fan_t *fan, const int *divisor, const int *box,
+		      const cech_direction_t *dirs, int ndirs,
+		      int kmin, int kmax, int *h, cech_profile_t *profile)
+{
+  const int dim = fan->dim, nrays = fan->nrays;
+  const int nh = kmax-kmin+1;
+  const int traversal = resolve_traversal(fan, box);
+  pattern_table_t table;
+  sweep_memo_t memo;
+  workspace_t *ws;
+  int current[nrays];
+  int *box_rows[dim];
+  int box_data[2*dim];
+  int t[ndirs > 0 ? ndirs : 1], dir[ndirs > 0 ? ndirs : 1];
+  long stride[ndirs > 0 ? ndirs : 1];
+  long npoints = 1;
+  long long visited;
+  double start;
+  int c, d, i;
+
+  if (kmin < 0 || kmax < kmin || traversal < 0)
     return -1;
+
+  /* The journal keys a run by its divisor, which a sweep keeps
+     changing. */
+  if (fan->journal)
+    return -1;
+
+  if (ndirs < 0 || ndirs > MAX_SWEEP_DIRECTIONS)
+    return -1;
+
+  for (d=ndirs-1; d>=0; d--) {
+    if (dirs[d].ray < 0 || dirs[d].ray >= nrays || dirs[d].lo > dirs[d].hi)
+      return -1;
+    stride[d] = npoints;
+    npoints *= dirs[d].hi - dirs[d].lo + 1;
   }
 
-  k = strtol(argv[2], &p, 10);
+  /* Start at the first point of the grid. */
+  memcpy(current, divisor, sizeof(current));
+  for (d=0; d<ndirs; d++) {
+    t[d] = dirs[d].lo;
+    dir[d] = 1;
+    current[dirs[d].ray] += t[d];
+  }
 
-  if (p == argv[2])
-    wrong_input(argv[2]);
+  start = wall_time();
 
-  if (getline(&line, &nline, fd) < 0)
-    wrong_input(line);
+  /* The vertices of the arrangement move linearly with the divisor, so
+     a box holding the compact regions at the corners of the grid holds
+     them at every point of the grid. The chambers cannot be updated as
+     a hyperplane moves, so when they are asked for the sweep goes
+     through that box too. */
+  for (i=0; i<dim; i++)
+    box_rows[i] = &box_data[2*i];
+  if (box)
+    memcpy(box_data, box, sizeof(box_data));
+  else {
+    for (c=0; c < 1<<ndirs; c++) {
+      int corner[nrays];
+      int corner_data[2*dim];
+      int *corner_rows[dim];
+
+      memcpy(corner, divisor, sizeof(corner));
+      for (d=0; d<ndirs; d++)
+	corner[dirs[d].ray] += (c & (1<<d)) ? dirs[d].hi : dirs[d].lo;
+
+      for (i=0; i<dim; i++)
+	corner_rows[i] = &corner_data[2*i];
+      compact_box(fan->rays, nrays, dim, corner, corner_rows);
+
+      for (i=0; i<dim; i++) {
+	if (c == 0 || corner_rows[i][0] < box_rows[i][0])
+	  box_rows[i][0] = corner_rows[i][0];
+	if (c == 0 || corner_rows[i][1] > box_rows[i][1])
+	  box_rows[i][1] = corner_rows[i][1];
+      }
+    }
+  }
 
-  if (sscanf(line, "%d", &dim) != 1)
-    wrong_input(line);
+  if (profile)
+    profile->box += wall_time() - start;
+
+  pattern_table_init(&table, nrays);
+  pattern_table_init(&memo.seen, nrays);
+  memo.h = NULL;
+  memo.nh = nh;
+  memo.compact = NULL;
+  memo.ncompact = 0;
+
+  ws = take_workspace(fan);
+
+  /* The box is traversed once, and updated as the hyperplanes move. */
+  start = wall_time();
+  traverse(box_rows, dim, fan->rays, nrays, current,
+	   traversal == TRAVERSE_POINTS, fan->nthreads, &table);
+  if (profile) {
+    profile->visited += table.visited;
+    profile->traversal += wall_time() - start;
+  }
 
-  scan_box_info(fd, dim, k);
+  for (;;) {
+    long index = 0;
 
-  free(line);
+    for (d=0; d<ndirs; d++)
+      index += (t[d] - dirs[d].lo)*stride[d];
 
-  fclose(fd);
+    sweep_point(&table, kmin, kmax, fan, &memo, ws->arenas, &h[index*nh],
+		profile);
 
-  return 0;
+    /* Go to the next point of the grid in boustrophedon order, so that
+       a single coefficient moves by one at each step: move the fastest
+       coordinate which has not reached the end in its direction, and
+       turn around the faster ones, which have. */
+    for (d=ndirs-1; d>=0; d--) {
+      if (t[d]+dir[d] >= dirs[d].lo && t[d]+dir[d] <= dirs[d].hi)
+	break;
+      dir[d] = -dir[d];
+    }
+    if (d < 0)
+      break;
+
+    t[d] += dir[d];
+
+    start = wall_time();
+    visited = table.visited;
+    move_hyperplane(box_rows, dim, fan->rays, nrays, current,
+		    dirs[d].ray, dir[d], &table);
+    if (profile) {
+      profile->visited += table.visited - visited;
+      profile->traversal += wall_time() - start;
+    }
+  }
+
+  give_back_workspace(fan, ws);
+
+  free(memo.h);
+  free(memo.compact);
+  pattern_table_free(&memo.seen);
+  pattern_table_free(&table);
+
+  return npoints;
 }
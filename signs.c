@@ -0,0 +1,138 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "signs.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+static void add_scalar(int32_t *dots, const int32_t *column, int n)
+{
+  int j;
+
+  for (j=0; j<n; j++)
+    dots[j] += column[j];
+}
+
+static void negative_scalar(const int32_t *dots, const int32_t *bounds, int n,
+			    uint64_t *negative)
+{
+  int j;
+
+  memset(negative, 0, ((n+63)/64)*sizeof(uint64_t));
+
+  for (j=0; j<n; j++) {
+    if (dots[j] < bounds[j])
+      negative[j/64] |= UINT64_C(1) << (j%64);
+  }
+}
+
+static const sign_kernels_t scalar_kernels = {
+  "scalar", add_scalar, negative_scalar
+};
+
+#ifdef HAVE_X86
+/* SSE2 is part of x86-64, but not of every x86, so these are compiled
+   for it explicitly too. Four rays at a time. */
+__attribute__((target("sse2")))
+static void add_sse2(int32_t *dots, const int32_t *column, int n)
+{
+  int j;
+
+  for (j=0; j<n; j+=4) {
+    __m128i d = _mm_loadu_si128((const __m128i *) &dots[j]);
+    __m128i c = _mm_loadu_si128((const __m128i *) &column[j]);
+
+    _mm_storeu_si128((__m128i *) &dots[j], _mm_add_epi32(d, c));
+  }
+}
+
+__attribute__((target("sse2")))
+static void negative_sse2(const int32_t *dots, const int32_t *bounds, int n,
+			  uint64_t *negative)
+{
+  int j;
+
+  memset(negative, 0, ((n+63)/64)*sizeof(uint64_t));
+
+  for (j=0; j<n; j+=4) {
+    __m128i d = _mm_loadu_si128((const __m128i *) &dots[j]);
+    __m128i b = _mm_loadu_si128((const __m128i *) &bounds[j]);
+    const uint64_t bits =
+      _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(d, b)));
+
+    negative[j/64] |= bits << (j%64);
+  }
+}
+
+static const sign_kernels_t sse2_kernels = {
+  "sse2", add_sse2, negative_sse2
+};
+
+/* Eight rays at a time. */
+__attribute__((target("avx2")))
+static void add_avx2(int32_t *dots, const int32_t *column, int n)
+{
+  int j;
+
+  for (j=0; j<n; j+=8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *) &dots[j]);
+    __m256i c = _mm256_loadu_si256((const __m256i *) &column[j]);
+
+    _mm256_storeu_si256((__m256i *) &dots[j], _mm256_add_epi32(d, c));
+  }
+}
+
+__attribute__((target("avx2")))
+static void negative_avx2(const int32_t *dots, const int32_t *bounds, int n,
+			  uint64_t *negative)
+{
+  int j;
+
+  memset(negative, 0, ((n+63)/64)*sizeof(uint64_t));
+
+  for (j=0; j<n; j+=8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *) &dots[j]);
+    __m256i b = _mm256_loadu_si256((const __m256i *) &bounds[j]);
+    const uint64_t bits =
+      _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, d)));
+
+    negative[j/64] |= bits << (j%64);
+  }
+}
+
+static const sign_kernels_t avx2_kernels = {
+  "avx2", add_avx2, negative_avx2
+};
+#endif
+
+const sign_kernels_t *sign_kernels(void)
+{
+#ifdef HAVE_X86
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return &avx2_kernels;
+  if (__builtin_cpu_supports("sse2"))
+    return &sse2_kernels;
+#endif
+
+  return &scalar_kernels;
+}
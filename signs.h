@@ -0,0 +1,31 @@
+#ifndef __SIGNS_H__
+#define __SIGNS_H__
+
+#include <stdint.h>
+
+/* Kernels for finding the sign patterns of the points of a box, which
+   keep <m,v_j> for every ray in an array of int32_t, so that moving
+   to the next point only takes adding a column of the rays. The
+   arrays are padded with zeros to a multiple of SIGNS_PAD entries. */
+#define SIGNS_PAD 8
+
+/* Number of entries of the arrays for n rays. */
+#define SIGNS_SIZE(n) (((n) + SIGNS_PAD-1) & ~(SIGNS_PAD-1))
+
+typedef struct {
+  const char *name;
+
+  /* dots[j] += column[j], for the n (padded) entries. */
+  void (*add)(int32_t *dots, const int32_t *column, int n);
+
+  /* Set bit j of negative (a bitset, see bitset.h, with room for n
+     bits, cleared first) iff dots[j] < bounds[j], for the n (padded)
+     entries. The padding must not be below its bound. */
+  void (*negative)(const int32_t *dots, const int32_t *bounds, int n,
+		   uint64_t *negative);
+} sign_kernels_t;
+
+/* The fastest kernels the processor we are running on supports. */
+const sign_kernels_t *sign_kernels(void);
+
+#endif
@@ -0,0 +1,476 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "bitset.h"
+#include "sparse.h"
+#include "threadpool.h"
+#include "timing.h"
+
+/* Primes used for the modular elimination. They are all below 2^31,
+   so products of two residues fit comfortably in 64 bits. */
+static const uint32_t primes[] = {2147483647u, 2147483629u};
+#define NPRIMES ((int)(sizeof(primes)/sizeof(primes[0])))
+
+/* A row of the matrix in echelon form, normalized so that the
+   leading coefficient (the one in cols[0]) is 1. Columns are stored
+   in decreasing order, so the leading coefficient is the one with the
+   largest column key: for the Cech differentials, whose rows and
+   columns are both in lexicographic order, this produces much less
+   fill-in than pivoting on the smallest column. */
+typedef struct {
+  int n;
+  uint64_t *cols;
+  uint32_t *vals;
+} pivot_row_t;
+
+/* State of the elimination modulo a given prime. */
+struct rank_stream_t {
+  uint32_t p;
+
+  /* Where the pivot rows and the pivot table live. */
+  arena_t *arena;
+
+  /* Hash table from the leading column of each pivot row to its
+     index in rows, with nbuckets (a power of two) buckets. Empty
+     buckets have position -1. */
+  uint64_t *keys;
+  int *positions;
+  int nbuckets;
+
+  pivot_row_t *rows;
+  int nrows;
+  int rows_size; /* Allocated size of rows */
+
+  /* Scratch space for the row being reduced. */
+  uint64_t *cols[2];
+  uint32_t *vals[2];
+  int nscratch;
+};
+
+static uint32_t mulmod(uint32_t a, uint32_t b, uint32_t p)
+{
+  return (uint32_t) (((uint64_t) a * b) % p);
+}
+
+/* Inverse of a modulo p, by Fermat's little theorem. */
+static uint32_t invmod(uint32_t a, uint32_t p)
+{
+  uint32_t result = 1, e = p-2;
+
+  while (e) {
+    if (e & 1)
+      result = mulmod(result, a, p);
+    a = mulmod(a, a, p);
+    e >>= 1;
+  }
+
+  return result;
+}
+
+static void ensure_scratch(rank_stream_t *el, int n)
+{
+  int i;
+
+  if (n <= el->nscratch)
+    return;
+
+  el->nscratch = 2*n;
+  for (i=0; i<2; i++) {
+    el->cols[i] = realloc(el->cols[i], el->nscratch*sizeof(uint64_t));
+    el->vals[i] = realloc(el->vals[i], el->nscratch*sizeof(uint32_t));
+  }
+}
+
+static int find_bucket(const rank_stream_t *el, uint64_t col)
+{
+  int b = hash_mix(col) & (el->nbuckets-1);
+
+  while (el->positions[b] >= 0 && el->keys[b] != col)
+    b = (b+1) & (el->nbuckets-1);
+
+  return b;
+}
+
+/* Make room in the pivot table for one more pivot. */
+static void grow_pivots(rank_stream_t *el)
+{
+  uint64_t *keys = el->keys;
+  int *positions = el->positions;
+  int nbuckets = el->nbuckets;
+  int i;
+
+  /* Keep the load factor at most one half. */
+  if (2*(el->nrows+1) <= el->nbuckets)
+    return;
+
+  el->nbuckets = nbuckets ? 2*nbuckets : 64;
+  el->keys = arena_alloc(el->arena, el->nbuckets*sizeof(uint64_t));
+  el->positions = arena_alloc(el->arena, el->nbuckets*sizeof(int));
+  for (i=0; i<el->nbuckets; i++)
+    el->positions[i] = -1;
+
+  for (i=0; i<nbuckets; i++) {
+    if (positions[i] >= 0) {
+      int b = find_bucket(el, keys[i]);
+
+      el->keys[b] = keys[i];
+      el->positions[b] = positions[i];
+    }
+  }
+}
+
+/* Reduce the row stored in the first scratch buffer against the
+   rows already in echelon form. Returns 1 if the row is linearly
+   independent of them, in which case it is added as a new pivot
+   row, and 0 otherwise. */
+static int reduce_row(rank_stream_t *el, int n)
+{
+  const uint32_t p = el->p;
+
+  while (n > 0) {
+    int bucket = find_bucket(el, el->cols[0][0]);
+    int piv = el->positions[bucket];
+    pivot_row_t *row;
+    uint32_t factor;
+    int i, j, t;
+
+    if (piv < 0) {
+      /* New pivot, normalize and store it. */
+      uint32_t inv = invmod(el->vals[0][0], p);
+
+      if (el->nrows == el->rows_size) {
+	int size = el->rows_size ? 2*el->rows_size : 16;
+
+	el->rows = arena_grow(el->arena, el->rows,
+			      el->rows_size*sizeof(pivot_row_t),
+			      size*sizeof(pivot_row_t));
+	el->rows_size = size;
+      }
+      row = &el->rows[el->nrows];
+
+      row->n = n;
+      row->cols = arena_alloc(el->arena, n*sizeof(uint64_t));
+      row->vals = arena_alloc(el->arena, n*sizeof(uint32_t));
+      memcpy(row->cols, el->cols[0], n*sizeof(uint64_t));
+      for (i=0; i<n; i++)
+	row->vals[i] = mulmod(el->vals[0][i], inv, p);
+
+      el->keys[bucket] = row->cols[0];
+      el->positions[bucket] = el->nrows++;
+
+      grow_pivots(el);
+
+      return 1;
+    }
+
+    /* Subtract factor times the pivot row, merging the two sorted
+       lists of columns. The leading entry cancels by construction. */
+    row = &el->rows[piv];
+    factor = p - el->vals[0][0];
+
+    ensure_scratch(el, n + row->n);
+
+    for (i=1, j=1, t=0; i<n || j<row->n;) {
+      if (j == row->n || (i < n && el->cols[0][i] > row->cols[j])) {
+	el->cols[1][t] = el->cols[0][i];
+	el->vals[1][t++] = el->vals[0][i++];
+      } else if (i == n || row->cols[j] > el->cols[0][i]) {
+	el->cols[1][t] = row->cols[j];
+	el->vals[1][t++] = mulmod(factor, row->vals[j++], p);
+      } else {
+	uint32_t v = (el->vals[0][i++] + mulmod(factor, row->vals[j++], p)) % p;
+
+	if (v) {
+	  el->cols[1][t] = el->cols[0][i-1];
+	  el->vals[1][t++] = v;
+	}
+      }
+    }
+
+    n = t;
+
+    /* Swap the scratch buffers, so the result is again in the
+       first one. */
+    {
+      uint64_t *c = el->cols[0];
+      uint32_t *v = el->vals[0];
+
+      el->cols[0] = el->cols[1];
+      el->vals[0] = el->vals[1];
+      el->cols[1] = c;
+      el->vals[1] = v;
+    }
+  }
+
+  return 0;
+}
+
+void rank_stream_row(rank_stream_t *el, const uint64_t *cols,
+		     const int *vals, int n)
+{
+  const uint32_t p = el->p;
+  int j;
+
+  ensure_scratch(el, n);
+
+  /* Copy the row into the scratch space, in decreasing column
+     order. Rows are short, so insertion sort is good enough. */
+  for (j=0; j<n; j++) {
+    uint64_t c = cols[j];
+    int v = vals[j] % (int64_t) p;
+    int t;
+
+    for (t=j; t>0 && el->cols[0][t-1] < c; t--) {
+      el->cols[0][t] = el->cols[0][t-1];
+      el->vals[0][t] = el->vals[0][t-1];
+    }
+    el->cols[0][t] = c;
+    el->vals[0][t] = (v < 0) ? (uint32_t) (v + (int64_t) p) : (uint32_t) v;
+  }
+
+  reduce_row(el, n);
+}
+
+static void init_stream(rank_stream_t *el, uint32_t p, arena_t *arena)
+{
+  memset(el, 0, sizeof(*el));
+  el->p = p;
+  el->arena = arena;
+  grow_pivots(el);
+}
+
+static void free_stream_scratch(rank_stream_t *el)
+{
+  int i;
+
+  for (i=0; i<2; i++) {
+    free(el->cols[i]);
+    free(el->vals[i]);
+  }
+}
+
+/* Rank modulo p of the matrix with the rows given by generate. */
+static int stream_rank_mod_p(row_generator_t generate, void *arg,
+			     uint32_t p, arena_t *arena)
+{
+  arena_mark_t mark = arena_mark(arena);
+  rank_stream_t el;
+  int rank;
+
+  init_stream(&el, p, arena);
+
+  generate(&el, arg);
+
+  rank = el.nrows;
+
+  free_stream_scratch(&el);
+
+  /* The echelon form is not needed any more. */
+  arena_release(arena, mark);
+
+  return rank;
+}
+
+int stream_rank(row_generator_t generate, void *arg, arena_t *arena)
+{
+  int i, rank = 0;
+
+  for (i=0; i<NPRIMES; i++) {
+    int r = stream_rank_mod_p(generate, arg, primes[i], arena);
+
+    if (i > 0 && r != rank)
+      fprintf(stderr, "WARNING: rank %d modulo %u differs from the rank "
+	      "%d found before, keeping the largest.\n", r, primes[i], rank);
+
+    if (r > rank)
+      rank = r;
+  }
+
+  return rank;
+}
+
+/* The state of a parallel rank computation modulo one prime. Each
+   block of rows is first reduced to echelon form on its own, and then
+   the echelon forms are merged pairwise, in a tree: at each step the
+   pivot rows of block b+step are reduced against those of block b. */
+typedef struct {
+  block_generator_t generate;
+  void *arg;
+  int nblocks;
+
+  uint32_t p;
+  rank_stream_t *el; /* One elimination per block */
+  arena_t *arenas; /* Where each block keeps its echelon form */
+
+  int step;
+
+  /* Seconds spent merging into each block. */
+  double *merge_times;
+} parallel_rank_t;
+
+static void block_task(int block, int worker, void *arg)
+{
+  parallel_rank_t *pr = arg;
+
+  (void) worker;
+
+  init_stream(&pr->el[block], pr->p, &pr->arenas[block]);
+  pr->generate(&pr->el[block], block, pr->nblocks, pr->arg);
+}
+
+static void merge_task(int task, int worker, void *arg)
+{
+  parallel_rank_t *pr = arg;
+  const int a = 2*task*pr->step, b = a + pr->step;
+  rank_stream_t *dst = &pr->el[a], *src = &pr->el[b];
+  double start = wall_time();
+  int i;
+
+  (void) worker;
+
+  if (b >= pr->nblocks)
+    return;
+
+  /* The rows of src are already sorted and normalized, so they go
+     straight into the scratch space of dst. */
+  for (i=0; i<src->nrows; i++) {
+    const pivot_row_t *row = &src->rows[i];
+
+    ensure_scratch(dst, row->n);
+    memcpy(dst->cols[0], row->cols, row->n*sizeof(uint64_t));
+    memcpy(dst->vals[0], row->vals, row->n*sizeof(uint32_t));
+
+    reduce_row(dst, row->n);
+  }
+
+  free_stream_scratch(src);
+  arena_reset(&pr->arenas[b]);
+
+  pr->merge_times[a] += wall_time() - start;
+}
+
+static int parallel_rank_mod_p(block_generator_t generate, void *arg,
+			       int nblocks, uint32_t p, arena_budget_t *budget,
+			       double *merge_times)
+{
+  parallel_rank_t pr = {
+    .generate = generate,
+    .arg = arg,
+    .nblocks = nblocks,
+    .p = p,
+    .merge_times = merge_times
+  };
+  int i, rank;
+
+  pr.el = malloc(nblocks*sizeof(rank_stream_t));
+  pr.arenas = malloc(nblocks*sizeof(arena_t));
+  for (i=0; i<nblocks; i++)
+    arena_init(&pr.arenas[i], budget);
+
+  run_tasks(nblocks, nblocks, block_task, &pr);
+
+  for (pr.step = 1; pr.step < nblocks; pr.step *= 2) {
+    int nmerges = (nblocks + 2*pr.step - 1) / (2*pr.step);
+
+    run_tasks(nmerges, nmerges, merge_task, &pr);
+  }
+
+  rank = pr.el[0].nrows;
+
+  free_stream_scratch(&pr.el[0]);
+  for (i=0; i<nblocks; i++)
+    arena_free(&pr.arenas[i]);
+  free(pr.arenas);
+  free(pr.el);
+
+  return rank;
+}
+
+int parallel_stream_rank(block_generator_t generate, void *arg, int nblocks,
+			 arena_t *arena, double *merge_time)
+{
+  double merge_times[nblocks];
+  int i, rank = 0;
+
+  memset(merge_times, 0, sizeof(merge_times));
+
+  for (i=0; i<NPRIMES; i++) {
+    /* The blocks charge the budget of the arena, which also holds
+       what the arena itself uses. */
+    int r = parallel_rank_mod_p(generate, arg, nblocks, primes[i],
+				arena->budget, merge_times);
+
+    if (i > 0 && r != rank)
+      fprintf(stderr, "WARNING: rank %d modulo %u differs from the rank "
+	      "%d found before, keeping the largest.\n", r, primes[i], rank);
+
+    if (r > rank)
+      rank = r;
+  }
+
+  if (merge_time) {
+    for (i=0; i<nblocks; i++)
+      *merge_time += merge_times[i];
+  }
+
+  return rank;
+}
+
+/* Feed the rows of a sparse matrix to the elimination, the given
+   block of them when the rows are split in nblocks contiguous
+   blocks. */
+static void matrix_block(rank_stream_t *stream, int block, int nblocks,
+			 void *arg)
+{
+  const sparse_matrix_t *m = arg;
+  const int start = (long long) m->nrows*block/nblocks;
+  const int end = (long long) m->nrows*(block+1)/nblocks;
+  int i;
+
+  for (i=start; i<end; i++) {
+    const int n = m->row_start[i+1] - m->row_start[i];
+    uint64_t cols[n];
+    int j;
+
+    for (j=0; j<n; j++)
+      cols[j] = m->cols[m->row_start[i]+j];
+
+    rank_stream_row(stream, cols, &m->vals[m->row_start[i]], n);
+  }
+}
+
+static void matrix_rows(rank_stream_t *stream, void *arg)
+{
+  matrix_block(stream, 0, 1, arg);
+}
+
+int sparse_rank(const sparse_matrix_t *m, int nthreads, arena_t *arena)
+{
+  if (m->nrows == 0 || m->ncols == 0)
+    return 0;
+
+  /* Small matrices are not worth the threads. */
+  if (nthreads > 1 && m->nrows >= PARALLEL_ROWS)
+    return parallel_stream_rank(matrix_block, (void *) m, nthreads, arena,
+				NULL);
+
+  return stream_rank(matrix_rows, (void *) m, arena);
+}
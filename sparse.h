@@ -0,0 +1,70 @@
+#ifndef __SPARSE_H__
+#define __SPARSE_H__
+
+#include <stdint.h>
+#include "arena.h"
+
+/* A sparse integer matrix in compressed row form. The entries of row
+   i are cols[j], vals[j] for row_start[i] <= j < row_start[i+1]. */
+typedef struct {
+  int nrows;
+  int ncols;
+
+  int *row_start; /* nrows+1 entries */
+  int *cols;
+  int *vals;
+} sparse_matrix_t;
+
+/* Matrices with fewer rows than this are not worth splitting among
+   threads. */
+#define PARALLEL_ROWS 20000
+
+/* Rank of the matrix over the rationals. This is computed by exact
+   sparse elimination modulo a few large primes, keeping the largest
+   rank found (the rank modulo p can only drop, never increase). The
+   echelon form is kept in the arena, and released before
+   returning. Large matrices are split in nthreads blocks of rows,
+   see parallel_stream_rank. */
+int sparse_rank(const sparse_matrix_t *m, int nthreads, arena_t *arena);
+
+/* The state of a rank computation whose rows arrive one at a
+   time. */
+typedef struct rank_stream_t rank_stream_t;
+
+/* Produces the rows of a matrix, passing each of them to
+   rank_stream_row. It is called once for each prime the rank is
+   computed modulo, and must produce the same rows every time. */
+typedef void (*row_generator_t)(rank_stream_t *stream, void *arg);
+
+/* Add a row with the given entries, in any order. The columns are
+   identified by arbitrary 64 bit keys, and elimination pivots on the
+   largest key of each row, so keys should increase along the natural
+   order of the columns. */
+void rank_stream_row(rank_stream_t *stream, const uint64_t *cols,
+		     const int *vals, int n);
+
+/* Rank over the rationals of the matrix whose rows are produced by
+   generate(stream, arg), as in sparse_rank. The matrix itself is
+   never stored, only its echelon form, which is allocated from the
+   arena and released before returning. */
+int stream_rank(row_generator_t generate, void *arg, arena_t *arena);
+
+/* Produces the rows in the given block, out of nblocks, of a matrix,
+   passing each of them to rank_stream_row. Each row must be in
+   exactly one block. */
+typedef void (*block_generator_t)(rank_stream_t *stream, int block,
+				  int nblocks, void *arg);
+
+/* Rank as in stream_rank, using one thread per block. Each thread
+   generates its block of rows and reduces it to echelon form on its
+   own, with the same choice of pivots as stream_rank, and then the
+   echelon forms are merged pairwise, in parallel, until only one is
+   left. Blocks of consecutive rows share most of their columns, so
+   most of the fill-in happens within the blocks. The blocks keep their
+   echelon forms in arenas of their own, charged to the budget of the
+   given one. If merge_time is not NULL, the seconds spent merging,
+   added up over the threads, are added to it. */
+int parallel_stream_rank(block_generator_t generate, void *arg, int nblocks,
+			 arena_t *arena, double *merge_time);
+
+#endif
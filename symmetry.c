@@ -0,0 +1,172 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "bitset.h"
+#include "symmetry.h"
+
+typedef struct {
+  uint64_t *const *cone_rays;
+  int ncones;
+  int nrays;
+  int nwords;
+
+  /* Number of cones containing both rays i and j, at
+     together[i*nrays+j]. The diagonal is the number of cones
+     containing each ray. A symmetry preserves these. */
+  int *together;
+
+  int *perm; /* The permutation being built */
+  int *used; /* Whether each ray is already an image */
+
+  symmetries_t *sym;
+  int max_perms;
+} search_t;
+
+/* Nonzero iff the permutation sends every cone to a cone. */
+static int preserves_cones(const search_t *s)
+{
+  uint64_t image[s->nwords];
+  int i, j, k;
+
+  for (i=0; i<s->ncones; i++) {
+    bitset_clear(image, s->nwords);
+    for (j=0; j<s->nrays; j++) {
+      if (bitset_contains(s->cone_rays[i], j))
+	bitset_add(image, s->perm[j]);
+    }
+
+    for (k=0; k<s->ncones; k++) {
+      if (bitset_equal(image, s->cone_rays[k], s->nwords))
+	break;
+    }
+    if (k == s->ncones)
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Try every image of ray j compatible with the images of the previous
+   rays. */
+static void extend(search_t *s, int j)
+{
+  symmetries_t *sym = s->sym;
+  const int n = s->nrays;
+  int c, i;
+
+  if (sym->nperms == s->max_perms)
+    return;
+
+  if (j == n) {
+    if (preserves_cones(s)) {
+      memcpy(&sym->perms[sym->nperms*n], s->perm, n*sizeof(int));
+      sym->nperms++;
+    }
+    return;
+  }
+
+  for (c=0; c<n; c++) {
+    if (s->used[c])
+      continue;
+
+    for (i=0; i<=j; i++) {
+      const int image = (i == j) ? c : s->perm[i];
+
+      if (s->together[i*n+j] != s->together[image*n+c])
+	break;
+    }
+    if (i <= j)
+      continue;
+
+    s->perm[j] = c;
+    s->used[c] = 1;
+    extend(s, j+1);
+    s->used[c] = 0;
+  }
+}
+
+void find_symmetries(uint64_t *const *cone_rays, int ncones, int nrays,
+		     int max_perms, symmetries_t *sym)
+{
+  search_t s = {
+    .cone_rays = cone_rays,
+    .ncones = ncones,
+    .nrays = nrays,
+    .nwords = BITSET_WORDS(nrays),
+    .sym = sym,
+    .max_perms = max_perms
+  };
+  int i, j, k;
+
+  sym->nrays = nrays;
+  sym->nwords = s.nwords;
+  sym->perms = malloc(max_perms*nrays*sizeof(int));
+  sym->nperms = 0;
+
+  s.together = calloc(nrays*nrays, sizeof(int));
+  for (k=0; k<ncones; k++) {
+    for (i=0; i<nrays; i++) {
+      if (!bitset_contains(cone_rays[k], i))
+	continue;
+      for (j=0; j<nrays; j++) {
+	if (bitset_contains(cone_rays[k], j))
+	  s.together[i*nrays+j]++;
+      }
+    }
+  }
+
+  s.perm = malloc(nrays*sizeof(int));
+  s.used = calloc(nrays, sizeof(int));
+
+  /* The smallest image is always tried first, so the identity comes
+     out first. */
+  extend(&s, 0);
+
+  free(s.together);
+  free(s.perm);
+  free(s.used);
+}
+
+void canonical_pattern(const symmetries_t *sym, const uint64_t *negative,
+		       uint64_t *canonical)
+{
+  const int n = sym->nrays, nwords = sym->nwords;
+  uint64_t image[nwords];
+  int i, j;
+
+  memcpy(canonical, negative, nwords*sizeof(uint64_t));
+
+  for (i=1; i<sym->nperms; i++) {
+    const int *perm = &sym->perms[i*n];
+
+    bitset_clear(image, nwords);
+    for (j=0; j<n; j++) {
+      if (bitset_contains(negative, j))
+	bitset_add(image, perm[j]);
+    }
+
+    if (bitset_compare(image, canonical, nwords) < 0)
+      memcpy(canonical, image, nwords*sizeof(uint64_t));
+  }
+}
+
+void free_symmetries(symmetries_t *sym)
+{
+  free(sym->perms);
+}
@@ -0,0 +1,34 @@
+#ifndef __SYMMETRY_H__
+#define __SYMMETRY_H__
+
+#include <stdint.h>
+
+/* Permutations of the rays sending every maximal cone of the fan to a
+   maximal cone. The Cech complex of a region only depends on which
+   rays are in which cones, and on the negative rays, so regions
+   whose negative rays are related by one of these permutations have
+   the same cohomology. */
+typedef struct {
+  int nrays;
+  int nwords; /* Words per set of rays */
+
+  /* Permutation i sends ray j to perms[i*nrays+j]. The first one is
+     the identity. */
+  int *perms;
+  int nperms;
+} symmetries_t;
+
+/* Find the symmetries of the fan whose cones have the given rays
+   (each a bitset of nwords words). At most max_perms of them are
+   kept, which is still correct, only less symmetric. */
+void find_symmetries(uint64_t *const *cone_rays, int ncones, int nrays,
+		     int max_perms, symmetries_t *sym);
+
+/* Store in canonical the smallest image of the set of negative rays
+   under the symmetries, comparing them as multi-word integers. */
+void canonical_pattern(const symmetries_t *sym, const uint64_t *negative,
+		       uint64_t *canonical);
+
+void free_symmetries(symmetries_t *sym);
+
+#endif
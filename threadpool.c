@@ -0,0 +1,284 @@
+/*
+  (C) 2010 Iñaki García Etxebarria
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+/* The tasks still to be run by one of the threads, [head, tail). The
+   owner takes tasks from the head, thieves from the tail. */
+typedef struct {
+  pthread_mutex_t lock;
+  int head;
+  int tail;
+} task_queue_t;
+
+/* Tasks passed to the idle threads of a pool by a call to run_tasks
+   from one of its tasks. */
+typedef struct job_t {
+  task_fn_t task;
+  void *arg;
+  int ntasks;
+  int next; /* Next task to take */
+  int done; /* Tasks finished */
+  struct job_t *next_job;
+} job_t;
+
+typedef struct {
+  task_queue_t *queues;
+  int nthreads;
+
+  task_fn_t task;
+  void *arg;
+
+  /* For run_tasks_sharing, the jobs with tasks left to take, and the
+     number of threads still running tasks of their own, protected by
+     lock. changed is signaled when a job is posted or finished, and
+     when a thread runs out of tasks. */
+  int sharing;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  job_t *jobs;
+  int active;
+} pool_t;
+
+typedef struct {
+  pool_t *pool;
+  int worker;
+} worker_t;
+
+/* The worker run by the current thread, NULL outside of pools. */
+static __thread worker_t *current_worker;
+
+/* Take the next task from our own queue. Returns -1 if it is empty. */
+static int pop_task(task_queue_t *queue)
+{
+  int i = -1;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->head < queue->tail)
+    i = queue->head++;
+  pthread_mutex_unlock(&queue->lock);
+
+  return i;
+}
+
+/* Take the last task from somebody else's queue. Returns -1 if it is
+   empty. */
+static int steal_task(task_queue_t *queue)
+{
+  int i = -1;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->head < queue->tail)
+    i = --queue->tail;
+  pthread_mutex_unlock(&queue->lock);
+
+  return i;
+}
+
+/* Run the tasks of the jobs posted to the pool, until no thread is
+   left which could post more. Called with the lock held. */
+static void help(pool_t *pool, int worker)
+{
+  pool->active--;
+  pthread_cond_broadcast(&pool->changed);
+
+  for (;;) {
+    job_t *job;
+    int i;
+
+    for (job = pool->jobs; job && job->next == job->ntasks;
+	 job = job->next_job)
+      ;
+
+    if (!job) {
+      if (pool->active == 0)
+	break;
+      pthread_cond_wait(&pool->changed, &pool->lock);
+      continue;
+    }
+
+    i = job->next++;
+    pthread_mutex_unlock(&pool->lock);
+    job->task(i, worker, job->arg);
+    pthread_mutex_lock(&pool->lock);
+
+    if (++job->done == job->ntasks)
+      pthread_cond_broadcast(&pool->changed);
+  }
+}
+
+/* Run the tasks of a call to run_tasks from a task of a sharing pool,
+   with the help of its idle threads. */
+static void run_shared(worker_t *w, int ntasks, task_fn_t task, void *arg)
+{
+  pool_t *pool = w->pool;
+  job_t job = {
+    .task = task,
+    .arg = arg,
+    .ntasks = ntasks
+  };
+  job_t **p;
+
+  pthread_mutex_lock(&pool->lock);
+  job.next_job = pool->jobs;
+  pool->jobs = &job;
+  pthread_cond_broadcast(&pool->changed);
+
+  while (job.next < ntasks) {
+    int i = job.next++;
+
+    pthread_mutex_unlock(&pool->lock);
+    task(i, w->worker, arg);
+    pthread_mutex_lock(&pool->lock);
+    job.done++;
+  }
+
+  /* Wait for the helpers still running our tasks. */
+  while (job.done < ntasks)
+    pthread_cond_wait(&pool->changed, &pool->lock);
+
+  for (p = &pool->jobs; *p != &job; p = &(*p)->next_job)
+    ;
+  *p = job.next_job;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *arg)
+{
+  worker_t *w = arg;
+  pool_t *pool = w->pool;
+
+  current_worker = w;
+
+  while (1) {
+    int i = pop_task(&pool->queues[w->worker]);
+    int victim;
+
+    /* Out of work, try the other threads in turn. Tasks are never
+       added, so once every queue is empty we are done. */
+    for (victim = 1; i < 0 && victim < pool->nthreads; victim++)
+      i = steal_task(&pool->queues[(w->worker+victim) % pool->nthreads]);
+
+    if (i < 0)
+      break;
+
+    pool->task(i, w->worker, pool->arg);
+  }
+
+  if (pool->sharing) {
+    pthread_mutex_lock(&pool->lock);
+    help(pool, w->worker);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  current_worker = NULL;
+
+  return NULL;
+}
+
+static void start_pool(int nthreads, int ntasks, task_fn_t task, void *arg,
+		       int sharing)
+{
+  pool_t pool;
+  pthread_t threads[nthreads];
+  worker_t workers[nthreads];
+  int i;
+
+  pool.nthreads = nthreads;
+  pool.task = task;
+  pool.arg = arg;
+  pool.sharing = sharing;
+  pool.jobs = NULL;
+  pool.active = nthreads;
+  if (sharing) {
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+  }
+  pool.queues = malloc(nthreads*sizeof(task_queue_t));
+
+  for (i=0; i<nthreads; i++) {
+    pthread_mutex_init(&pool.queues[i].lock, NULL);
+    pool.queues[i].head = (long long) ntasks*i/nthreads;
+    pool.queues[i].tail = (long long) ntasks*(i+1)/nthreads;
+  }
+
+  for (i=0; i<nthreads; i++) {
+    workers[i].pool = &pool;
+    workers[i].worker = i;
+    pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+  }
+
+  for (i=0; i<nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  for (i=0; i<nthreads; i++)
+    pthread_mutex_destroy(&pool.queues[i].lock);
+  free(pool.queues);
+  if (sharing) {
+    pthread_cond_destroy(&pool.changed);
+    pthread_mutex_destroy(&pool.lock);
+  }
+}
+
+void run_tasks(int nthreads, int ntasks, task_fn_t task, void *arg)
+{
+  worker_t *w = current_worker;
+  int i;
+
+  if (w && w->pool->sharing) {
+    run_shared(w, ntasks, task, arg);
+    return;
+  }
+
+  if (nthreads > ntasks)
+    nthreads = ntasks;
+
+  if (nthreads <= 1) {
+    for (i=0; i<ntasks; i++)
+      task(i, 0, arg);
+    return;
+  }
+
+  start_pool(nthreads, ntasks, task, arg, 0);
+}
+
+void run_tasks_sharing(int nthreads, int ntasks, task_fn_t task, void *arg)
+{
+  int i;
+
+  if (nthreads <= 1) {
+    for (i=0; i<ntasks; i++)
+      task(i, 0, arg);
+    return;
+  }
+
+  start_pool(nthreads, ntasks, task, arg, 1);
+}
+
+int threads_for(int n)
+{
+  if (n <= 0) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (ncpus > 0) ? ncpus : 1;
+  }
+
+  return n;
+}
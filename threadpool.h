@@ -0,0 +1,29 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+/* A task to run: i is the task number, and worker the number of the
+   thread running it, 0 <= worker < nthreads. */
+typedef void (*task_fn_t)(int i, int worker, void *arg);
+
+/* Run task(i, worker, arg) for each 0 <= i < ntasks, using nthreads
+   threads, and wait for all of them to finish. Each thread starts
+   with a contiguous block of tasks, which it runs in increasing
+   order, and when it runs out of tasks it steals them from the end of
+   the block of another thread. With nthreads <= 1 the tasks are run
+   in order in the calling thread. */
+void run_tasks(int nthreads, int ntasks, task_fn_t task, void *arg);
+
+/* Same as run_tasks, but the threads which run out of tasks stay
+   around to help the others: a call to run_tasks from one of the tasks
+   runs its tasks in the calling thread and in the idle threads, which
+   may join at any point, instead of starting threads of its own. Such
+   nested tasks get the worker number of whichever thread runs them, so
+   they must not depend on it. All the threads are started even if
+   there are fewer tasks. */
+void run_tasks_sharing(int nthreads, int ntasks, task_fn_t task, void *arg);
+
+/* Number of threads to use when the user asked for n of them, with 0
+   meaning one per online processor. */
+int threads_for(int n);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include <time.h>
+
+/* Seconds on a monotonic clock, for measuring how long things take. */
+static inline double wall_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+#endif